@@ -49,6 +49,9 @@ struct poolsock {
 #define POOLSOCK_MAGIC			0x1b0a2d38
 	VTAILQ_ENTRY(poolsock)		list;
 	struct listen_sock		*lsock;
+	unsigned			sock_idx;
+	unsigned			accept_idx;
+	unsigned			listening;
 	struct pool_task		task[1];
 	struct pool			*pool;
 	void				*vca_priv;
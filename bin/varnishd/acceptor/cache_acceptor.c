@@ -131,11 +131,23 @@ VCA_NewPool(struct pool *pp)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Called when a thread pool is dropped, before its tasks are told to
+ * die. Sockets only this pool accepts from are handed over to the heir.
+ */
+
 void
-VCA_DestroyPool(struct pool *pp)
+VCA_DestroyPool(struct pool *pp, struct pool *heir)
 {
+	struct acceptor *vca;
 	struct poolsock *ps;
 
+	VCA_Foreach(vca) {
+		CHECK_OBJ_NOTNULL(vca, ACCEPTOR_MAGIC);
+		if (vca->destroy != NULL)
+			vca->destroy(pp, heir);
+	}
+
 	while (!VTAILQ_EMPTY(&pp->poolsocks)) {
 		ps = VTAILQ_FIRST(&pp->poolsocks);
 		VTAILQ_REMOVE(&pp->poolsocks, ps, list);
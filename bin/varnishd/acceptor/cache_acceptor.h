@@ -53,6 +53,7 @@ typedef void acceptor_start_f(struct cli *);
 typedef void acceptor_event_f(struct cli *, struct listen_sock *,
     enum vca_event);
 typedef void acceptor_accept_f(struct pool *);
+typedef void acceptor_destroy_f(struct pool *, struct pool *);
 typedef void acceptor_update_f(struct lock *);
 typedef void acceptor_shutdown_f(void);
 
@@ -71,6 +72,7 @@ struct acceptor {
 	acceptor_start_f		*start;
 	acceptor_event_f		*event;
 	acceptor_accept_f		*accept;
+	acceptor_destroy_f		*destroy;
 	acceptor_update_f		*update;
 	acceptor_shutdown_f		*shutdown;
 };
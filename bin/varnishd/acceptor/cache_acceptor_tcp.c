@@ -32,6 +32,7 @@
 
 #include "config.h"
 
+#include <sched.h>
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -99,6 +100,32 @@ static const unsigned enable_so_keepalive = 1;
  */
 static const unsigned enable_tcp_nodelay = 1;
 
+/*--------------------------------------------------------------------
+ * With reuseport=, a listen address has several sockets, see
+ * mgt_acceptor_tcp.c
+ */
+
+static unsigned
+vca_tcp_nsocks(const struct listen_sock *ls)
+{
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	return (ls->nsocks > 0 ? ls->nsocks : 1);
+}
+
+static int
+vca_tcp_sock(const struct listen_sock *ls, unsigned u)
+{
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	if (ls->nsocks == 0) {
+		AZ(u);
+		return (ls->sock);
+	}
+	assert(u < ls->nsocks);
+	return (ls->socks[u]);
+}
+
 /*--------------------------------------------------------------------
  * Some kernels have bugs/limitations with respect to which options are
  * inherited from the accept/listen socket, so we have to keep track of
@@ -208,6 +235,7 @@ vca_tcp_sockopt_set(const struct listen_sock *ls, const struct sess *sp)
 	struct conn_heritage *ch;
 	struct sock_opt *so;
 	vxid_t vxid;
+	unsigned u, nsock;
 	int n, sock;
 
 	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
@@ -216,9 +244,11 @@ vca_tcp_sockopt_set(const struct listen_sock *ls, const struct sess *sp)
 		CHECK_OBJ(sp, SESS_MAGIC);
 		sock = sp->fd;
 		vxid = sp->vxid;
+		nsock = 1;
 	} else {
 		sock = ls->sock;
 		vxid = NO_VXID;
+		nsock = vca_tcp_nsocks(ls);
 	}
 
 	for (n = 0; n < n_sock_opts; n++) {
@@ -242,8 +272,12 @@ vca_tcp_sockopt_set(const struct listen_sock *ls, const struct sess *sp)
 		VSL(SLT_Debug, vxid,
 		    "sockopt: Setting %s for %s=%s",
 		    so->strname, ls->name, ls->endpoint);
-		VTCP_Assert(setsockopt(sock,
-		    so->level, so->optname, so->arg, so->sz));
+		for (u = 0; u < nsock; u++) {
+			if (sp == NULL)
+				sock = vca_tcp_sock(ls, u);
+			VTCP_Assert(setsockopt(sock,
+			    so->level, so->optname, so->arg, so->sz));
+		}
 
 		if (sp == NULL)
 			ch->listen_mod = so->mod;
@@ -256,20 +290,41 @@ vca_tcp_init(void)
 
 }
 
+/*
+ * With reuseport=, only the first socket is listened on when starting,
+ * the others by the accept tasks using them, see vca_tcp_accept().
+ */
+
 static int
-vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
+vca_tcp_listen_sock(int sock)
 {
 
-	CHECK_OBJ_NOTNULL(ls->transport, TRANSPORT_MAGIC);
-	assert (ls->sock > 0);	// We know where stdin is
+	assert(sock > 0);	// We know where stdin is
 
 	if (cache_param->tcp_fastopen &&
-	    VTCP_fastopen(ls->sock, cache_param->listen_depth))
+	    VTCP_fastopen(sock, cache_param->listen_depth))
 		VSL(SLT_Error, NO_VXID,
 		    "Kernel TCP Fast Open: sock=%d, errno=%d %s",
-		    ls->sock, errno, VAS_errtxt(errno));
+		    sock, errno, VAS_errtxt(errno));
+
+	if (listen(sock, cache_param->listen_depth))
+		return (-1);
+
+	if (cache_param->accept_filter && VTCP_filter_http(sock))
+		VSL(SLT_Error, NO_VXID,
+		    "Kernel filtering: sock=%d, errno=%d %s",
+		    sock, errno, VAS_errtxt(errno));
+
+	return (0);
+}
+
+static int
+vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
+{
 
-	if (listen(ls->sock, cache_param->listen_depth)) {
+	CHECK_OBJ_NOTNULL(ls->transport, TRANSPORT_MAGIC);
+
+	if (vca_tcp_listen_sock(ls->sock)) {
 		VCLI_SetResult(cli, CLIS_CANT);
 		VCLI_Out(cli, "Listen failed on socket '%s': %s",
 		    ls->endpoint, VAS_errtxt(errno));
@@ -284,11 +339,6 @@ vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
 	ls->test_heritage = 1;
 	vca_tcp_sockopt_set(ls, NULL);
 
-	if (cache_param->accept_filter && VTCP_filter_http(ls->sock))
-		VSL(SLT_Error, NO_VXID,
-		    "Kernel filtering: sock=%d, errno=%d %s",
-		    ls->sock, errno, VAS_errtxt(errno));
-
 	return (0);
 }
 
@@ -430,7 +480,7 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	struct listen_sock *ls;
 	struct wrk_accept wa;
 	struct poolsock *ps;
-	int i;
+	int i, sock;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(ps, arg, POOLSOCK_MAGIC);
@@ -441,6 +491,18 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	while (!pool_accepting)
 		VTIM_sleep(.1);
 
+	if (ps->sock_idx > 0 && !ps->listening) {
+		/* listen(2) again is harmless if another pool did */
+		sock = vca_tcp_sock(ls, ps->sock_idx);
+		if (sock > 0 && vca_tcp_listen_sock(sock)) {
+			VSL(SLT_Error, NO_VXID,
+			    "Listen failed: sock=%d, errno=%d %s",
+			    sock, errno, VAS_errtxt(errno));
+			ps->accept_idx = 0;
+		}
+		ps->listening = 1;
+	}
+
 	/* Dont hold on to (possibly) discarded VCLs */
 	if (wrk->wpriv->vcl != NULL)
 		VCL_Rel(&wrk->wpriv->vcl);
@@ -453,14 +515,15 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 
 		wa.acceptaddrlen = sizeof wa.acceptaddr;
 		do {
-			i = accept(ls->sock, (void*)&wa.acceptaddr,
+			sock = vca_tcp_sock(ls, ps->accept_idx);
+			i = accept(sock, (void*)&wa.acceptaddr,
 			    &wa.acceptaddrlen);
 		} while (i < 0 && errno == EAGAIN && !ps->pool->die);
 
 		if (i < 0 && ps->pool->die)
 			break;
 
-		if (i < 0 && ls->sock == -2) {
+		if (i < 0 && vca_tcp_sock(ls, ps->accept_idx) == -2) {
 			/* Shut down in progress */
 			sleep(2);
 			continue;
@@ -496,12 +559,12 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 			i = errno;
 			wrk->stats->sess_fail++;
 
-			VTCP_myname(ls->sock, laddr, VTCP_ADDRBUFSIZE,
+			VTCP_myname(sock, laddr, VTCP_ADDRBUFSIZE,
 			    lport, VTCP_PORTBUFSIZE);
 
 			VSL(SLT_SessError, NO_VXID, "%s %s %s %d %d \"%s\"",
 			    wa.acceptlsock->name, laddr, lport,
-			    ls->sock, i, VAS_errtxt(i));
+			    sock, i, VAS_errtxt(i));
 			(void)Pool_TrySumstat(wrk);
 			continue;
 		}
@@ -531,23 +594,102 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	FREE_OBJ(ps);
 }
 
+/*
+ * Pools take turns on the sockets of a listen address with reuseport=.
+ * A socket is only listened on once a pool accepts from it, so with fewer
+ * pools than sockets, the kernel does not hand connections to the others.
+ * Once listened on, a socket stays in the SO_REUSEPORT group, so when its
+ * last pool is dropped, it is handed over to a surviving pool.
+ *
+ * ls->vca_priv counts the live pools accepting from each socket, it is only
+ * touched from the pool herder thread, which creates and drops pools.
+ */
+
+static unsigned *
+vca_tcp_sock_pools(struct listen_sock *ls)
+{
+	unsigned *np;
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	if (ls->vca_priv == NULL) {
+		np = calloc(vca_tcp_nsocks(ls), sizeof *np);
+		AN(np);
+		ls->vca_priv = np;
+	}
+	return (ls->vca_priv);
+}
+
+static void
+vca_tcp_add_poolsock(struct pool *pp, struct listen_sock *ls, unsigned u)
+{
+	struct poolsock *ps;
+
+	ALLOC_OBJ(ps, POOLSOCK_MAGIC);
+	AN(ps);
+	ps->lsock = ls;
+	ps->sock_idx = u;
+	ps->accept_idx = u;
+	ps->task->func = vca_tcp_accept_task;
+	ps->task->priv = ps;
+	ps->pool = pp;
+	vca_tcp_sock_pools(ls)[u]++;
+	VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
+	AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
+}
+
+/*
+ * This is called from pool_mkpool(), so with thread_pool_affinity, we run
+ * on the CPUs of the pool and can ask the kernel to prefer the socket for
+ * connections arriving there.
+ */
+
 static void
 vca_tcp_accept(struct pool *pp)
 {
 	struct listen_sock *ls;
-	struct poolsock *ps;
+	unsigned *np, u, v;
+#if defined(SO_INCOMING_CPU)
+	int cpu;
+#endif
 
 	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
 		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
-		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
-		AN(ps);
-		ps->lsock = ls;
-		ps->task->func = vca_tcp_accept_task;
-		ps->task->priv = ps;
-		ps->pool = pp;
-		VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
-		AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
+		np = vca_tcp_sock_pools(ls);
+		u = 0;
+		for (v = 1; v < vca_tcp_nsocks(ls); v++)
+			if (np[v] < np[u])
+				u = v;
+#if defined(SO_INCOMING_CPU)
+		cpu = sched_getcpu();
+		if (ls->nsocks > 0 && np[u] == 0 &&
+		    cache_param->wthread_affinity && cpu >= 0)
+			(void)setsockopt(vca_tcp_sock(ls, u),
+			    SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof cpu);
+#endif
+		vca_tcp_add_poolsock(pp, ls, u);
+	}
+}
+
+static void
+vca_tcp_destroy(struct pool *pp, struct pool *heir)
+{
+	struct poolsock *ps;
+	unsigned *np;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(heir, POOL_MAGIC);
+	assert(pp != heir);
+
+	VTAILQ_FOREACH(ps, &pp->poolsocks, list) {
+		CHECK_OBJ_NOTNULL(ps, POOLSOCK_MAGIC);
+		CHECK_OBJ_NOTNULL(ps->lsock, LISTEN_SOCK_MAGIC);
+		if (ps->lsock->vca != &TCP_acceptor)
+			continue;
+		np = vca_tcp_sock_pools(ps->lsock);
+		assert(np[ps->sock_idx] > 0);
+		if (--np[ps->sock_idx] == 0)
+			vca_tcp_add_poolsock(heir, ps->lsock, ps->sock_idx);
 	}
 }
 
@@ -588,11 +730,19 @@ static void
 vca_tcp_shutdown(void)
 {
 	struct listen_sock *ls;
+	unsigned u;
 	int i;
 
 	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
 		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
+		for (u = 1; u < ls->nsocks; u++) {
+			i = ls->socks[u];
+			ls->socks[u] = -2;
+			(void)close(i);
+		}
+		if (ls->nsocks > 0)
+			ls->socks[0] = -2;
 		i = ls->sock;
 		ls->sock = -2;
 		(void)close(i);
@@ -609,6 +759,7 @@ struct acceptor TCP_acceptor = {
 	.start		= vca_tcp_start,
 	.event		= vca_tcp_event,
 	.accept		= vca_tcp_accept,
+	.destroy	= vca_tcp_destroy,
 	.update		= vca_tcp_update,
 	.shutdown	= vca_tcp_shutdown,
 };
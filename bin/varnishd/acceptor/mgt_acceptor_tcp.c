@@ -59,19 +59,37 @@ vca_tcp_config(void)
 	return (0);
 }
 
+/*
+ * With reuseport=, we open that many sockets, which the pools take turns
+ * to accept from. The first one is ls->sock and also determines the port
+ * of the others if the argument had port zero.
+ */
+
 static int
 vca_tcp_opensocket(struct listen_sock *ls)
 {
+	const struct suckaddr *sa;
+	unsigned u;
 	int fail;
 
 	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
+	for (u = 1; u < ls->nsocks; u++) {
+		if (ls->socks[u] < 0)
+			continue;
+		MCH_Fd_Inherit(ls->socks[u], NULL);
+		closefd(&ls->socks[u]);
+	}
+
 	if (ls->sock > 0) {
 		MCH_Fd_Inherit(ls->sock, NULL);
 		closefd(&ls->sock);
 	}
 
-	ls->sock = VTCP_bind(ls->addr, NULL);
+	if (ls->nsocks > 0)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else
+		ls->sock = VTCP_bind(ls->addr, NULL);
 	fail = errno;
 
 	if (ls->sock < 0) {
@@ -82,7 +100,33 @@ vca_tcp_opensocket(struct listen_sock *ls)
 	AZ(ls->perms);
 	MCH_Fd_Inherit(ls->sock, "sock");
 
-	return (0);
+	if (ls->nsocks == 0)
+		return (0);
+
+	ls->socks[0] = ls->sock;
+	sa = VTCP_my_suckaddr(ls->sock);
+	AN(sa);
+	for (u = 1; u < ls->nsocks; u++) {
+		ls->socks[u] = VTCP_bind_reuseport(sa, NULL);
+		if (ls->socks[u] < 0) {
+			fail = errno;
+			AN(fail);
+			break;
+		}
+		MCH_Fd_Inherit(ls->socks[u], "sock");
+	}
+	VSA_free(&sa);
+
+	if (u == ls->nsocks)
+		return (0);
+
+	/* Do not keep a partial set of sockets */
+	while (u-- > 0) {
+		MCH_Fd_Inherit(ls->socks[u], NULL);
+		closefd(&ls->socks[u]);
+	}
+	ls->sock = -1;
+	return (fail);
 }
 
 static int v_matchproto_(vss_resolved_f)
@@ -92,6 +136,7 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	struct listen_sock *ls;
 	char abuf[VTCP_ADDRBUFSIZE], pbuf[VTCP_PORTBUFSIZE];
 	char nbuf[VTCP_ADDRBUFSIZE+VTCP_PORTBUFSIZE+2];
+	unsigned u;
 	int fail;
 
 	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
@@ -110,6 +155,14 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	ls->sock = -1;
 	ls->vca = &TCP_acceptor;
 
+	if (la->reuseport > 0) {
+		ls->nsocks = la->reuseport;
+		ls->socks = malloc(ls->nsocks * sizeof *ls->socks);
+		AN(ls->socks);
+		for (u = 0; u < ls->nsocks; u++)
+			ls->socks[u] = -1;
+	}
+
 	ls->addr = VSA_Clone(sa);
 	AN(ls->addr);
 
@@ -125,6 +178,7 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	if (fail) {
 		VSA_free(&ls->addr);
 		free(ls->endpoint);
+		free(ls->socks);
 		FREE_OBJ(ls);
 		if (fail != EAFNOSUPPORT)
 			ARGV_ERR("Could not get socket %s: %s\n",
@@ -163,6 +217,8 @@ int
 vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 {
 	const struct transport *xp = NULL;
+	const char *val;
+	char *p;
 
 	CHECK_OBJ_NOTNULL(la, LISTEN_ARG_MAGIC);
 	AN(av);
@@ -184,6 +240,24 @@ vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 			continue;
 		}
 
+		val = keyval(av[i], "reuseport=");
+		if (val != NULL && la->reuseport > 0)
+			ARGV_ERR("Too many reuseport sub-args in -a (%s)\n",
+			    av[i]);
+		if (val != NULL) {
+#ifndef SO_REUSEPORT
+			ARGV_ERR("SO_REUSEPORT not supported, -a (%s)\n",
+			    av[i]);
+#endif
+			errno = 0;
+			la->reuseport = strtoul(val, &p, 10);
+			if (errno || *p != '\0' || la->reuseport < 1 ||
+			    la->reuseport > 1024)
+				ARGV_ERR("Invalid reuseport sub-arg %s in -a\n",
+				    val);
+			continue;
+		}
+
 		ARGV_ERR("Invalid sub-arg %s in -a\n", av[i]);
 	}
 
@@ -172,6 +172,8 @@ struct http {
 
 	/* NB: ->nhd and below zeroed/initialized by http_Teardown */
 	uint16_t		nhd;		/* Next free hd */
+#define HTTP_HDX_SZ		80
+	uint16_t		hdx[HTTP_HDX_SZ]; /* First hd of known hdrs */
 
 	enum VSL_tag_e		logtag;		/* Must be SLT_*Method */
 	struct vsl_log		*vsl;
@@ -216,6 +218,7 @@ struct pool_task {
 	VTAILQ_ENTRY(pool_task)		list;
 	task_func_t			*func;
 	void				*priv;
+	vtim_mono			queued;
 };
 
 /*
@@ -350,25 +353,32 @@ struct objcore {
 	struct objhead		*objhead;
 	struct boc		*boc;
 	vtim_real		timer_when;
-	VCL_INT			hits;
-
-
 	vtim_real		t_origin;
+	vtim_real		t_stale_if_error;
+
+	/*
+	 * The remaining members are ordered by size to avoid padding, there
+	 * can be hundreds of millions of objcores.
+	 */
 	float			ttl;
 	float			grace;
 	float			keep;
 	float			stale_if_error;
-	vtim_real		t_stale_if_error;
+
+	uint32_t		last_lru;	// OC_TS_PACK()
+	uint32_t		hits;		// saturating
+	unsigned		timer_idx;	// XXX 4Gobj limit
+	unsigned		waitinglist_gen;
+
+	uint16_t		oa_present;
 
 	uint8_t			flags;
 
 	uint8_t			exp_flags;
 
-	uint16_t		oa_present;
+	uint8_t			lru_queue;
+	uint8_t			lru_freq;
 
-	unsigned		timer_idx;	// XXX 4Gobj limit
-	unsigned		waitinglist_gen;
-	vtim_real		last_lru;
 	VTAILQ_ENTRY(objcore)	hsh_list;
 	VTAILQ_ENTRY(objcore)	lru_list;
 	VTAILQ_ENTRY(objcore)	ban_list;
@@ -939,6 +949,7 @@ vai_hdl ObjVAIinit(struct worker *, struct objcore *, struct ws *,
 int ObjVAIlease(struct worker *, vai_hdl, struct vscarab *);
 int ObjVAIbuffer(struct worker *, vai_hdl, struct vscarab *);
 void ObjVAIreturn(struct worker *, vai_hdl, struct vscaret *);
+int ObjVAIfd(struct worker *, vai_hdl, const struct viov *, off_t *);
 void ObjVAIfini(struct worker *, vai_hdl *);
 
 /* cache_req_body.c */
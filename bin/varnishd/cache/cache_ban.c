@@ -188,6 +188,7 @@ ban_mark_completed(struct ban *b)
 		b->spec[BANS_FLAGS] |= BANS_FLAG_COMPLETED;
 		VWMB();
 		vbe32enc(b->spec + BANS_LENGTH, BANS_HEAD_LEN);
+		ban_tidx_remove(b);
 		VSC_C_main->bans_completed++;
 		bans_persisted_fragmentation += ln - ban_len(b->spec);
 		VSC_C_main->bans_persisted_fragmentation =
@@ -244,6 +245,37 @@ ban_iter(const uint8_t **bs, struct ban_test *bt)
 		bt->arg2_spec = ban_get_lump(bs);
 }
 
+/*--------------------------------------------------------------------
+ * Find the first test which the ban test index can use: An equality
+ * comparison on req.url or an obj.http.* header
+ */
+
+int
+ban_index_test(const uint8_t *bs, uint8_t *arg, const char **hdr,
+    const char **val)
+{
+	struct ban_test bt;
+	const uint8_t *be;
+
+	AN(arg);
+	AN(hdr);
+	AN(val);
+	be = bs + ban_len(bs);
+	bs += BANS_HEAD_LEN;
+	while (bs < be) {
+		ban_iter(&bs, &bt);
+		if (bt.oper != BANS_OPER_EQ)
+			continue;
+		if (bt.arg1 != BANS_ARG_URL && bt.arg1 != BANS_ARG_OBJHTTP)
+			continue;
+		*arg = bt.arg1;
+		*hdr = bt.arg1_spec;
+		*val = bt.arg2;
+		return (1);
+	}
+	return (0);
+}
+
 /*--------------------------------------------------------------------
  * A new object is created, grab a reference to the newest ban
  */
@@ -309,7 +341,8 @@ BAN_FindBan(vtim_real t0)
 
 /*--------------------------------------------------------------------
  * Grab a reference to a ban and associate the objcore with that ban.
- * Assume we have a BAN_Hold, so list traversal is safe.
+ * Assume we have a BAN_Hold or a reference from BAN_GrabBan(), so the
+ * ban cannot go away.
  */
 
 void
@@ -320,13 +353,47 @@ BAN_RefBan(struct objcore *oc, struct ban *b)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	AZ(oc->ban);
 	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
-	assert(ban_holds > 0);
+	assert(ban_holds > 0 || b->refcount > 0);
 	b->refcount++;
 	VTAILQ_INSERT_TAIL(&b->objcore, oc, ban_list);
 	oc->ban = b;
 	Lck_Unlock(&ban_mtx);
 }
 
+/*--------------------------------------------------------------------
+ * Grab a reference to the ban of an objcore we hold a reference to, such
+ * that a copy of it can be inserted with the same ban. Returns NULL if
+ * the lurker already took the objcore off its ban list.
+ */
+
+struct ban *
+BAN_GrabBan(const struct objcore *oc)
+{
+	struct ban *b;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	Lck_Lock(&ban_mtx);
+	b = oc->ban;
+	if (b != NULL) {
+		CHECK_OBJ(b, BAN_MAGIC);
+		b->refcount++;
+	}
+	Lck_Unlock(&ban_mtx);
+	return (b);
+}
+
+void
+BAN_DropBan(struct ban **bp)
+{
+	struct ban *b;
+
+	TAKE_OBJ_NOTNULL(b, bp, BAN_MAGIC);
+	Lck_Lock(&ban_mtx);
+	assert(b->refcount > 0);
+	b->refcount--;
+	Lck_Unlock(&ban_mtx);
+}
+
 /*--------------------------------------------------------------------
  * Compile a full ban list and export this area to the stevedores for
  * persistence.
@@ -433,6 +500,7 @@ ban_reload(const uint8_t *ban, unsigned len)
 		VTAILQ_INSERT_TAIL(&ban_head, b2, list);
 	else
 		VTAILQ_INSERT_BEFORE(b, b2, list);
+	ban_tidx_insert(b2);
 	bans_persisted_bytes += len;
 	VSC_C_main->bans_persisted_bytes = bans_persisted_bytes;
 
@@ -555,9 +623,9 @@ ban_evaluate(struct worker *wrk, const uint8_t *bsarg, struct objcore *oc,
 			darg2 = bt.arg2_double;
 			break;
 		case BANS_ARG_OBJLASTHIT:
-			if (isnan(oc->last_lru))
+			if (oc->last_lru == OC_TS_NONE)
 				return (0);
-			darg1 = 0.0 - oc->last_lru;
+			darg1 = 0.0 - OC_TS_UNPACK(oc->last_lru);
 			darg2 = 0.0 - (ban_time(bsarg) - bt.arg2_double);
 			break;
 		default:
@@ -644,7 +712,11 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	struct ban *b;
 	struct vsl_log *vsl;
 	struct ban *b0, *bn;
-	unsigned tests;
+	struct ban_tidx_dim *dims[BAN_TIDX_MAXDIM];
+	const char *vals[BAN_TIDX_MAXDIM];
+	struct ban *cand[BAN_TIDX_MAXCAND];
+	unsigned u, ndim = 0, tests;
+	int i, ncand;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -667,8 +739,10 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	Lck_Lock(&ban_mtx);
 	b0 = ban_start;
 	bn = oc->ban;
-	if (b0 != bn)
+	if (b0 != bn) {
 		bn->refcount++;
+		ndim = ban_tidx_dims(dims);
+	}
 	Lck_Unlock(&ban_mtx);
 
 	AN(bn);
@@ -680,21 +754,51 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	AN(bn);
 
 	/*
-	 * This loop is safe without locks, because we know we hold
-	 * a refcount on a ban somewhere in the list and we do not
-	 * inspect the list past that ban.
+	 * Only bans in the index under one of our values or without an
+	 * indexable test can match. The candidates are newer than bn, so
+	 * our refcount keeps them from being freed.
 	 */
+	for (u = 0; u < ndim; u++)
+		vals[u] = ban_tidx_value(wrk, dims[u], oc, req->http);
+	Lck_Lock(&ban_mtx);
+	ncand = ban_tidx_candidates(dims, vals, ndim, ban_time(bn->spec),
+	    cand);
+	Lck_Unlock(&ban_mtx);
+
 	tests = 0;
-	for (b = b0; b != bn; b = VTAILQ_NEXT(b, list)) {
-		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
-		if (b->flags & BANS_FLAG_COMPLETED)
-			continue;
-		if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
-			break;
+	if (ncand >= 0) {
+		b = bn;
+		for (i = 0; i < ncand; i++) {
+			CHECK_OBJ_NOTNULL(cand[i], BAN_MAGIC);
+			if (cand[i]->flags & BANS_FLAG_COMPLETED)
+				continue;
+			if (ban_evaluate(wrk, cand[i]->spec, oc, req->http,
+			    &tests)) {
+				b = cand[i];
+				break;
+			}
+		}
+	} else {
+		/*
+		 * This loop is safe without locks, because we know we hold
+		 * a refcount on a ban somewhere in the list and we do not
+		 * inspect the list past that ban.
+		 */
+		for (b = b0; b != bn; b = VTAILQ_NEXT(b, list)) {
+			CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+			if (b->flags & BANS_FLAG_COMPLETED)
+				continue;
+			if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
+				break;
+		}
 	}
 
 	Lck_Lock(&ban_mtx);
 	bn->refcount--;
+	if (ncand >= 0)
+		VSC_C_main->bans_index_checked++;
+	else
+		VSC_C_main->bans_index_fallback++;
 	VSC_C_main->bans_tested++;
 	VSC_C_main->bans_tests_tested += tests;
 
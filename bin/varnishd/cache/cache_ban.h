@@ -121,6 +121,8 @@
 
 /*--------------------------------------------------------------------*/
 
+VTAILQ_HEAD(banhead_s,ban);
+
 struct ban {
 	unsigned		magic;
 #define BAN_MAGIC		0x700b08ea
@@ -131,9 +133,13 @@ struct ban {
 
 	VTAILQ_HEAD(,objcore)	objcore;
 	uint8_t			*spec;
+
+	/* cache_ban_tidx.c, protected by ban_mtx */
+	VTAILQ_ENTRY(ban)	tidx_list;
+	struct banhead_s	*tidx_head;
+	struct ban_tidx_key	*tidx_key;
 };
 
-VTAILQ_HEAD(banhead_s,ban);
 
 bgthread_t ban_lurker;
 extern struct lock ban_mtx;
@@ -152,6 +158,8 @@ void ban_info_drop(const uint8_t *ban, unsigned len);
 
 int ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
     const struct http *reqhttp, unsigned *tests);
+int ban_index_test(const uint8_t *bs, uint8_t *arg, const char **hdr,
+    const char **val);
 vtim_real ban_time(const uint8_t *banspec);
 int ban_equal(const uint8_t *bs1, const uint8_t *bs2);
 void BAN_Free(struct ban *b);
@@ -160,3 +168,15 @@ void ban_kick_lurker(void);
 // cache_ban_idx.c
 struct ban * BANIDX_lookup(vtim_real);
 void BANIDX_fini(void);
+
+// cache_ban_tidx.c
+#define BAN_TIDX_MAXDIM		8
+#define BAN_TIDX_MAXCAND	64
+struct ban_tidx_dim;
+void ban_tidx_insert(struct ban *);
+void ban_tidx_remove(struct ban *);
+unsigned ban_tidx_dims(struct ban_tidx_dim **);
+const char *ban_tidx_value(struct worker *, const struct ban_tidx_dim *,
+    struct objcore *, const struct http *);
+int ban_tidx_candidates(struct ban_tidx_dim * const *, const char * const *,
+    unsigned, vtim_real, struct ban **);
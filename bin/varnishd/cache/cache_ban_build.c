@@ -32,6 +32,7 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
@@ -383,7 +384,14 @@ BAN_Commit(struct ban_proto *bp)
 		return (ban_error(bp, "Shutting down"));
 	}
 	bi = VTAILQ_FIRST(&ban_head);
+	if (bi != NULL && !(t0 > ban_time(bi->spec))) {
+		/* The ban test index relies on ban times being ordered */
+		t0 = nextafter(ban_time(bi->spec), INFINITY);
+		memcpy(&u, &t0, sizeof u);
+		vbe64enc(b->spec + BANS_TIMESTAMP, u);
+	}
 	VTAILQ_INSERT_HEAD(&ban_head, b, list);
+	ban_tidx_insert(b);
 	ban_start = b;
 
 	VSC_C_main->bans++;
@@ -32,13 +32,19 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "cache_varnishd.h"
 
 #include "cache_ban.h"
 #include "cache_objhead.h"
 
+#include "vend.h"
 #include "vtim.h"
 
+#include "VSC_lurker.h"
+
 static struct objcore oc_mark_cnt = { .magic = OBJCORE_MAGIC, };
 static struct objcore oc_mark_end = { .magic = OBJCORE_MAGIC, };
 static unsigned ban_batch;
@@ -86,6 +92,7 @@ ban_cleantail(struct banhead_s *obans)
 				VSC_C_main->bans_req--;
 			VSC_C_main->bans--;
 			VSC_C_main->bans_deleted++;
+			ban_tidx_remove(b);
 			VTAILQ_REMOVE(&ban_head, b, list);
 			VTAILQ_INSERT_TAIL(&freelist, b, list);
 			bans_persisted_fragmentation +=
@@ -206,7 +213,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 				 * dismantled under our feet - grab a ref
 				 */
 				AZ(oc->flags & OC_F_BUSY);
-				oc->refcnt += 1;
+				OC_REF(oc);
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
 				VTAILQ_INSERT_TAIL(&bt->objcore, oc, ban_list);
 				Lck_Unlock(&oh->mtx);
@@ -228,15 +235,244 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 	return (oc);
 }
 
+/*--------------------------------------------------------------------
+ * Test one object against the obans and kill it or move it to bd
+ */
+
+struct ban_lurker_stat {
+	uint64_t		tested;
+	uint64_t		tested_tests;
+	uint64_t		lok;
+	uint64_t		lokc;
+};
+
 static void
-ban_lurker_test_ban(struct worker *wrk, struct ban *bt,
-    struct banhead_s *obans, struct ban *bd, int kill)
+ban_lurker_sumstat(struct ban_lurker_stat *st)
+{
+
+	Lck_AssertHeld(&ban_mtx);
+	VSC_C_main->bans_lurker_tested += st->tested;
+	VSC_C_main->bans_lurker_tests_tested += st->tested_tests;
+	VSC_C_main->bans_lurker_obj_killed += st->lok;
+	VSC_C_main->bans_lurker_obj_killed_cutoff += st->lokc;
+	memset(st, 0, sizeof *st);
+}
+
+/*
+ * With more than one lurker thread, the obans list is shared, so we can
+ * only skip completed bans instead of pruning them.
+ */
+
+static void
+ban_lurker_test_oc(struct worker *wrk, struct objcore *oc, struct ban *bt,
+    struct banhead_s *obans, struct ban *bd, int kill,
+    struct ban_lurker_stat *st, int prune)
 {
 	struct ban *bl, *bln;
-	struct objcore *oc;
 	unsigned tests;
 	int i;
-	uint64_t tested = 0, tested_tests = 0, lok = 0, lokc = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	i = 0;
+	VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
+		if (oc->ban != bt) {
+			/*
+			 * HSH_Lookup() grabbed this oc, killed
+			 * it or tested it to top.  We're done.
+			 */
+			break;
+		}
+		if (bl->flags & BANS_FLAG_COMPLETED) {
+			/* Ban was overtaken by new (dup) ban */
+			if (prune)
+				VTAILQ_REMOVE(obans, bl, l_list);
+			continue;
+		}
+		if (kill == 1)
+			i = 1;
+		else {
+			AZ(bl->flags & BANS_FLAG_REQ);
+			tests = 0;
+			i = ban_evaluate(wrk, bl->spec, oc, NULL,
+			    &tests);
+			st->tested++;
+			st->tested_tests += tests;
+		}
+		if (i) {
+			if (kill) {
+				VSLb(wrk->vsl, SLT_ExpBan,
+				    "%ju killed for lurker cutoff",
+				    VXID(ObjGetXID(wrk, oc)));
+				st->lokc++;
+			} else {
+				VSLb(wrk->vsl, SLT_ExpBan,
+				    "%ju banned by lurker",
+				    VXID(ObjGetXID(wrk, oc)));
+				st->lok++;
+			}
+			HSH_Kill(oc);
+			break;
+		}
+	}
+	if (i == 0 && oc->ban == bt) {
+		Lck_Lock(&ban_mtx);
+		if (oc->ban == bt && bt != bd) {
+			bt->refcount--;
+			VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
+			oc->ban = bd;
+			bd->refcount++;
+			VTAILQ_INSERT_TAIL(&bd->objcore, oc, ban_list);
+			i = 1;
+		}
+		Lck_Unlock(&ban_mtx);
+		if (i)
+			ObjSendEvent(wrk, oc, OEV_BANCHG);
+	}
+	(void)HSH_DerefObjCore(wrk, &oc);
+}
+
+/*--------------------------------------------------------------------
+ * Lurker threads
+ *
+ * With ban_lurker_threads > 1, the ban lurker still walks the ban list
+ * and picks the objects as before, but hands them to the lurker threads
+ * in batches, sharded by objhead digest, and waits for each round of
+ * batches to finish. The ban list is thus worked through in the same
+ * order, and bans are completed at the same points.
+ */
+
+#define LURKER_SHARD_BATCH	32
+
+struct ban_lurker_shard {
+	unsigned		magic;
+#define BAN_LURKER_SHARD_MAGIC	0x2c81e5d7
+	unsigned		n;
+	unsigned		fill;
+	pthread_cond_t		cond;
+	struct VSC_lurker	*vsc;
+	struct vsc_seg		*vsc_seg;
+	struct objcore		*oc[LURKER_SHARD_BATCH];
+};
+
+static struct VSC_lck		*lck_lurker;
+static struct lock		lurker_mtx;
+static pthread_cond_t		lurker_done;
+static unsigned			lurker_pending;
+static struct ban_lurker_shard	*lurker_shard;
+static unsigned			lurker_nshard;
+
+/* The current job, set by ban_lurker_test_ban() */
+static struct ban		*lurker_bt;
+static struct ban		*lurker_bd;
+static struct banhead_s		*lurker_obans;
+static int			lurker_kill;
+
+static void * v_matchproto_(bgthread_t)
+ban_lurker_shard_thread(struct worker *wrk, void *priv)
+{
+	struct ban_lurker_shard *ls;
+	struct ban_lurker_stat st;
+	struct vsl_log vsl;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(ls, priv, BAN_LURKER_SHARD_MAGIC);
+
+	VSL_Setup(&vsl, NULL, 0);
+	AZ(wrk->vsl);
+	wrk->vsl = &vsl;
+
+	Lck_Lock(&lurker_mtx);
+	while (1) {
+		if (ls->n == 0) {
+			(void)Lck_CondWait(&ls->cond, &lurker_mtx);
+			continue;
+		}
+		Lck_Unlock(&lurker_mtx);
+
+		memset(&st, 0, sizeof st);
+		for (u = 0; u < ls->n; u++)
+			ban_lurker_test_oc(wrk, ls->oc[u], lurker_bt,
+			    lurker_obans, lurker_bd, lurker_kill, &st, 0);
+		ls->vsc->batches++;
+		ls->vsc->objects += ls->n;
+		ls->vsc->tested += st.tested;
+		ls->vsc->killed += st.lok + st.lokc;
+		Lck_Lock(&ban_mtx);
+		ban_lurker_sumstat(&st);
+		Lck_Unlock(&ban_mtx);
+		VSL_Flush(&vsl, 0);
+
+		Lck_Lock(&lurker_mtx);
+		ls->n = 0;
+		assert(lurker_pending > 0);
+		if (--lurker_pending == 0)
+			PTOK(pthread_cond_signal(&lurker_done));
+	}
+	NEEDLESS(return (NULL));
+}
+
+static void
+ban_lurker_dispatch(void)
+{
+	struct ban_lurker_shard *ls;
+	unsigned u;
+
+	Lck_Lock(&lurker_mtx);
+	AZ(lurker_pending);
+	for (u = 0; u < lurker_nshard; u++) {
+		ls = &lurker_shard[u];
+		if (ls->fill == 0)
+			continue;
+		AZ(ls->n);
+		ls->n = ls->fill;
+		ls->fill = 0;
+		lurker_pending++;
+		PTOK(pthread_cond_signal(&ls->cond));
+	}
+	while (lurker_pending > 0)
+		(void)Lck_CondWait(&lurker_done, &lurker_mtx);
+	Lck_Unlock(&lurker_mtx);
+}
+
+static void
+ban_lurker_shard_init(void)
+{
+	struct ban_lurker_shard *ls;
+	pthread_t thr;
+	unsigned u;
+	char buf[20];
+
+	lurker_nshard = cache_param->ban_lurker_threads;
+	if (lurker_nshard < 2)
+		return;
+	lck_lurker = Lck_CreateClass(NULL, "lurker");
+	Lck_New(&lurker_mtx, lck_lurker);
+	PTOK(pthread_cond_init(&lurker_done, NULL));
+	lurker_shard = calloc(lurker_nshard, sizeof *lurker_shard);
+	AN(lurker_shard);
+	for (u = 0; u < lurker_nshard; u++) {
+		ls = &lurker_shard[u];
+		INIT_OBJ(ls, BAN_LURKER_SHARD_MAGIC);
+		PTOK(pthread_cond_init(&ls->cond, NULL));
+		ls->vsc = VSC_lurker_New(NULL, &ls->vsc_seg, "%u", u);
+		AN(ls->vsc);
+		bprintf(buf, "ban-lurker-%u", u);
+		WRK_BgThread(&thr, buf, ban_lurker_shard_thread, ls);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+ban_lurker_test_ban(struct worker *wrk, struct ban *bt,
+    struct banhead_s *obans, struct ban *bd, int kill)
+{
+	struct ban_lurker_shard *ls = NULL;
+	struct ban_lurker_stat st;
+	struct objcore *oc;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
@@ -253,88 +489,45 @@ ban_lurker_test_ban(struct worker *wrk, struct ban *bt,
 	if (oc == NULL)
 		return;
 
+	memset(&st, 0, sizeof st);
+	lurker_bt = bt;
+	lurker_obans = obans;
+	lurker_bd = bd;
+	lurker_kill = kill;
 	while (1) {
 		if (++ban_batch > cache_param->ban_lurker_batch) {
+			if (lurker_nshard > 1)
+				ban_lurker_dispatch();
 			(void)Pool_TrySumstat(wrk);
 			VTIM_sleep(cache_param->ban_lurker_sleep);
 			ban_batch = 0;
 		}
 		oc = ban_lurker_getfirst(wrk->vsl, bt);
-		if (oc == NULL) {
-			if (tested == 0 && lokc == 0) {
-				AZ(tested_tests);
-				AZ(lok);
-				return;
-			}
-			Lck_Lock(&ban_mtx);
-			VSC_C_main->bans_lurker_tested += tested;
-			VSC_C_main->bans_lurker_tests_tested += tested_tests;
-			VSC_C_main->bans_lurker_obj_killed += lok;
-			VSC_C_main->bans_lurker_obj_killed_cutoff += lokc;
-			Lck_Unlock(&ban_mtx);
-			return;
-		}
-		i = 0;
-		VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
-			if (oc->ban != bt) {
-				/*
-				 * HSH_Lookup() grabbed this oc, killed
-				 * it or tested it to top.  We're done.
-				 */
-				break;
-			}
-			if (bl->flags & BANS_FLAG_COMPLETED) {
-				/* Ban was overtaken by new (dup) ban */
-				VTAILQ_REMOVE(obans, bl, l_list);
-				continue;
-			}
-			if (kill == 1)
-				i = 1;
-			else {
-				AZ(bl->flags & BANS_FLAG_REQ);
-				tests = 0;
-				i = ban_evaluate(wrk, bl->spec, oc, NULL,
-				    &tests);
-				tested++;
-				tested_tests += tests;
-			}
-			if (i) {
-				if (kill) {
-					VSLb(wrk->vsl, SLT_ExpBan,
-					    "%ju killed for lurker cutoff",
-					    VXID(ObjGetXID(wrk, oc)));
-					lokc++;
-				} else {
-					VSLb(wrk->vsl, SLT_ExpBan,
-					    "%ju banned by lurker",
-					    VXID(ObjGetXID(wrk, oc)));
-					lok++;
-				}
-				HSH_Kill(oc);
-				break;
-			}
-		}
-		if (i == 0 && oc->ban == bt) {
-			Lck_Lock(&ban_mtx);
-			VSC_C_main->bans_lurker_tested += tested;
-			VSC_C_main->bans_lurker_tests_tested += tested_tests;
-			VSC_C_main->bans_lurker_obj_killed += lok;
-			VSC_C_main->bans_lurker_obj_killed_cutoff += lokc;
-			tested = tested_tests = lok = lokc = 0;
-			if (oc->ban == bt && bt != bd) {
-				bt->refcount--;
-				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
-				oc->ban = bd;
-				bd->refcount++;
-				VTAILQ_INSERT_TAIL(&bd->objcore, oc, ban_list);
-				i = 1;
-			}
-			Lck_Unlock(&ban_mtx);
-			if (i)
-				ObjSendEvent(wrk, oc, OEV_BANCHG);
+		if (oc == NULL)
+			break;
+		if (lurker_nshard < 2) {
+			ban_lurker_test_oc(wrk, oc, bt, obans, bd, kill, &st,
+			    1);
+			continue;
 		}
-		(void)HSH_DerefObjCore(wrk, &oc);
+		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+		ls = &lurker_shard[
+		    vbe32dec(oc->objhead->digest) % lurker_nshard];
+		ls->oc[ls->fill++] = oc;
+		if (ls->fill == LURKER_SHARD_BATCH)
+			ban_lurker_dispatch();
 	}
+	if (lurker_nshard > 1)
+		ban_lurker_dispatch();
+
+	if (st.tested == 0 && st.lokc == 0) {
+		AZ(st.tested_tests);
+		AZ(st.lok);
+		return;
+	}
+	Lck_Lock(&ban_mtx);
+	ban_lurker_sumstat(&st);
+	Lck_Unlock(&ban_mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -424,6 +617,8 @@ ban_lurker(struct worker *wrk, void *priv)
 	AZ(wrk->vsl);
 	wrk->vsl = &vsl;
 
+	ban_lurker_shard_init();
+
 	while (!ban_shutdown) {
 		dt = ban_lurker_work(wrk);
 		if (DO_DEBUG(DBG_LURKER))
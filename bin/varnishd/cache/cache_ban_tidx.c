@@ -0,0 +1,293 @@
+/*-
+ * Copyright 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The ban test index keeps all active bans which have an equality test on
+ * req.url or an obj.http.* header in a tree per "dimension" (the url or
+ * the header name), keyed by the value they compare against. All other
+ * active bans go on a plain list.
+ *
+ * A ban with req.url == "/foo" can only match objects looked up with that
+ * url, so BAN_CheckObject() only needs to evaluate the bans found under
+ * the object's values plus the bans on the plain list. All lists are kept
+ * newest first, such that collecting the bans newer than the object's ban
+ * stops at the first older one.
+ *
+ * Completed bans are removed from the index. Everything here is protected
+ * by ban_mtx, except for dimensions, which are never freed and can hence
+ * be used to fetch object values without holding the lock.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_ban.h"
+
+struct ban_tidx_key {
+	unsigned		magic;
+#define BAN_TIDX_KEY_MAGIC	0x1f4c7b3a
+	VRBT_ENTRY(ban_tidx_key) tree;
+	struct ban_tidx_dim	*dim;
+	struct banhead_s	bans;
+	char			*val;
+};
+
+static inline int
+ban_tidx_key_cmp(const struct ban_tidx_key *k1, const struct ban_tidx_key *k2)
+{
+
+	return (strcmp(k1->val, k2->val));
+}
+
+VRBT_HEAD(ban_tidx_keys, ban_tidx_key);
+VRBT_GENERATE_REMOVE_COLOR(ban_tidx_keys, ban_tidx_key, tree, static)
+VRBT_GENERATE_REMOVE(ban_tidx_keys, ban_tidx_key, tree, static)
+VRBT_GENERATE_FIND(ban_tidx_keys, ban_tidx_key, tree, ban_tidx_key_cmp, static)
+VRBT_GENERATE_INSERT_COLOR(ban_tidx_keys, ban_tidx_key, tree, static)
+VRBT_GENERATE_INSERT_FINISH(ban_tidx_keys, ban_tidx_key, tree, static)
+VRBT_GENERATE_INSERT(ban_tidx_keys, ban_tidx_key, tree, ban_tidx_key_cmp,
+    static)
+
+struct ban_tidx_dim {
+	unsigned		magic;
+#define BAN_TIDX_DIM_MAGIC	0x6e0d93c5
+	uint8_t			arg;
+	char			*hdr;
+	struct ban_tidx_keys	keys;
+};
+
+static struct ban_tidx_dim	*ban_tidx_dim[BAN_TIDX_MAXDIM];
+static unsigned			ban_tidx_ndim;
+static struct banhead_s		ban_tidx_plain =
+    VTAILQ_HEAD_INITIALIZER(ban_tidx_plain);
+
+/*--------------------------------------------------------------------*/
+
+static struct ban_tidx_dim *
+ban_tidx_dim_get(uint8_t arg, const char *hdr)
+{
+	struct ban_tidx_dim *d;
+	unsigned u;
+
+	for (u = 0; u < ban_tidx_ndim; u++) {
+		d = ban_tidx_dim[u];
+		CHECK_OBJ_NOTNULL(d, BAN_TIDX_DIM_MAGIC);
+		if (d->arg != arg)
+			continue;
+		if (hdr == NULL)
+			return (d);
+		AN(d->hdr);
+		if (!memcmp(d->hdr, hdr, hdr[0] + 2))
+			return (d);
+	}
+	if (ban_tidx_ndim == BAN_TIDX_MAXDIM)
+		return (NULL);
+
+	ALLOC_OBJ(d, BAN_TIDX_DIM_MAGIC);
+	AN(d);
+	d->arg = arg;
+	if (hdr != NULL) {
+		d->hdr = malloc(hdr[0] + 2);
+		AN(d->hdr);
+		memcpy(d->hdr, hdr, hdr[0] + 2);
+	}
+	VRBT_INIT(&d->keys);
+	ban_tidx_dim[ban_tidx_ndim++] = d;
+	return (d);
+}
+
+/*
+ * Bans are inserted at the head by BAN_Commit(), but ban_reload() can
+ * insert older bans, which usually belong near the tail.
+ */
+
+static void
+ban_tidx_list_insert(struct banhead_s *head, struct ban *b)
+{
+	struct ban *b2;
+	vtim_real t;
+
+	t = ban_time(b->spec);
+	b2 = VTAILQ_FIRST(head);
+	if (b2 == NULL || ban_time(b2->spec) < t) {
+		VTAILQ_INSERT_HEAD(head, b, tidx_list);
+	} else {
+		VTAILQ_FOREACH_REVERSE(b2, head, banhead_s, tidx_list)
+			if (ban_time(b2->spec) > t)
+				break;
+		AN(b2);
+		VTAILQ_INSERT_AFTER(head, b2, b, tidx_list);
+	}
+	b->tidx_head = head;
+}
+
+void
+ban_tidx_insert(struct ban *b)
+{
+	struct ban_tidx_key *k, needle;
+	struct ban_tidx_dim *d = NULL;
+	const char *hdr, *val;
+	uint8_t arg;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	AZ(b->tidx_head);
+
+	if (b->flags & BANS_FLAG_COMPLETED)
+		return;
+	if (ban_index_test(b->spec, &arg, &hdr, &val))
+		d = ban_tidx_dim_get(arg, hdr);
+	if (d == NULL) {
+		ban_tidx_list_insert(&ban_tidx_plain, b);
+		return;
+	}
+
+	INIT_OBJ(&needle, BAN_TIDX_KEY_MAGIC);
+	needle.val = TRUST_ME(val);
+	k = VRBT_FIND(ban_tidx_keys, &d->keys, &needle);
+	if (k == NULL) {
+		ALLOC_OBJ(k, BAN_TIDX_KEY_MAGIC);
+		AN(k);
+		k->dim = d;
+		VTAILQ_INIT(&k->bans);
+		k->val = strdup(val);
+		AN(k->val);
+		AZ(VRBT_INSERT(ban_tidx_keys, &d->keys, k));
+	}
+	b->tidx_key = k;
+	ban_tidx_list_insert(&k->bans, b);
+	VSC_C_main->bans_indexed++;
+}
+
+void
+ban_tidx_remove(struct ban *b)
+{
+	struct ban_tidx_key *k;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+
+	if (b->tidx_head == NULL)
+		return;
+	VTAILQ_REMOVE(b->tidx_head, b, tidx_list);
+	b->tidx_head = NULL;
+	k = b->tidx_key;
+	if (k == NULL)
+		return;
+	b->tidx_key = NULL;
+	CHECK_OBJ(k, BAN_TIDX_KEY_MAGIC);
+	assert(VSC_C_main->bans_indexed > 0);
+	VSC_C_main->bans_indexed--;
+	if (!VTAILQ_EMPTY(&k->bans))
+		return;
+	CHECK_OBJ_NOTNULL(k->dim, BAN_TIDX_DIM_MAGIC);
+	VRBT_REMOVE(ban_tidx_keys, &k->dim->keys, k);
+	free(k->val);
+	FREE_OBJ(k);
+}
+
+/*--------------------------------------------------------------------
+ * Lookup side, see BAN_CheckObject()
+ */
+
+unsigned
+ban_tidx_dims(struct ban_tidx_dim **dims)
+{
+	unsigned u;
+
+	Lck_AssertHeld(&ban_mtx);
+	for (u = 0; u < ban_tidx_ndim; u++)
+		dims[u] = ban_tidx_dim[u];
+	return (ban_tidx_ndim);
+}
+
+const char *
+ban_tidx_value(struct worker *wrk, const struct ban_tidx_dim *d,
+    struct objcore *oc, const struct http *reqhttp)
+{
+	hdr_t hdr;
+
+	CHECK_OBJ_NOTNULL(d, BAN_TIDX_DIM_MAGIC);
+	switch (d->arg) {
+	case BANS_ARG_URL:
+		CHECK_OBJ_NOTNULL(reqhttp, HTTP_MAGIC);
+		return (reqhttp->hd[HTTP_HDR_URL].b);
+	case BANS_ARG_OBJHTTP:
+		CAST_HDR(hdr, d->hdr);
+		return (HTTP_GetHdrPack(wrk, oc, hdr));
+	default:
+		WRONG("Wrong ban index dimension");
+	}
+	NEEDLESS(return (NULL));
+}
+
+static int
+ban_tidx_collect(const struct banhead_s *head, vtim_real t,
+    struct ban **cand, int n)
+{
+	struct ban *b;
+
+	VTAILQ_FOREACH(b, head, tidx_list) {
+		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+		if (ban_time(b->spec) <= t)
+			break;
+		if (n == BAN_TIDX_MAXCAND)
+			return (-1);
+		cand[n++] = b;
+	}
+	return (n);
+}
+
+/*
+ * Collect the bans newer than t which can match an object with the
+ * given values. Returns -1 if there are more than BAN_TIDX_MAXCAND, in
+ * which case the caller falls back to checking the ban list.
+ */
+
+int
+ban_tidx_candidates(struct ban_tidx_dim * const *dims,
+    const char * const *vals, unsigned ndim, vtim_real t, struct ban **cand)
+{
+	struct ban_tidx_key *k, needle;
+	unsigned u;
+	int n;
+
+	Lck_AssertHeld(&ban_mtx);
+	n = ban_tidx_collect(&ban_tidx_plain, t, cand, 0);
+	INIT_OBJ(&needle, BAN_TIDX_KEY_MAGIC);
+	for (u = 0; n >= 0 && u < ndim; u++) {
+		CHECK_OBJ_NOTNULL(dims[u], BAN_TIDX_DIM_MAGIC);
+		if (vals[u] == NULL)
+			continue;
+		needle.val = TRUST_ME(vals[u]);
+		k = VRBT_FIND(ban_tidx_keys, &dims[u]->keys, &needle);
+		if (k != NULL)
+			n = ban_tidx_collect(&k->bans, t, cand, n);
+	}
+	return (n);
+}
@@ -34,14 +34,24 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
 #include "cache_objhead.h"
 
 #include "vbh.h"
+#include "vend.h"
 #include "vtim.h"
 
+#include "VSC_exp.h"
+
+/*
+ * Expiry is sharded by the object's hash digest. Each shard has its own
+ * inbox, timer heap and thread. The main counters are summed from the
+ * shards' pending counts under exp_stat_mtx, see exp_sumstat().
+ */
+
 struct exp_priv {
 	unsigned			magic;
 #define EXP_PRIV_MAGIC			0x9db22482
@@ -49,17 +59,38 @@ struct exp_priv {
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	struct VSC_exp			*stats;
+	uint64_t			mailed;
+	uint64_t			superseded;
 
 	/* owned by exp thread */
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct vbh			*heap;
 	pthread_t			thread;
+	uint64_t			received;
+	uint64_t			expired;
+	uint64_t			stale_kept;
+	vtim_real			t_sumstat;
+	char				name[16];
 };
 
-static struct exp_priv *exphdl;
+static struct exp_priv **exphdl;
+static unsigned exp_nshards;
+static struct lock exp_stat_mtx;
 static int exp_shutdown = 0;
 
+static struct exp_priv *
+exp_shard(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (exp_nshards == 1)
+		return (exphdl[0]);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	return (exphdl[vbe32dec(oc->objhead->digest) % exp_nshards]);
+}
+
 /*---------------------------------------------------------------------
  * Calculate the point in time when an object will become stale, taking
  * req.max_age into account, if available
@@ -101,29 +132,58 @@ EXP_Ttl_grace(const struct req *req, const struct objcore *oc)
  */
 
 static void
-exp_mail_it(struct objcore *oc, uint8_t cmds)
+exp_mail_it(struct exp_priv *ep, struct objcore *oc, uint8_t cmds)
 {
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 	AZ(cmds & OC_EF_REFD);
 
-	Lck_AssertHeld(&exphdl->mtx);
+	Lck_AssertHeld(&ep->mtx);
 
 	if (oc->exp_flags & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
 			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
 			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
-			VSC_C_main->exp_mailed++;
+			ep->stats->mailed++;
+			ep->stats->inbox++;
+			ep->mailed++;
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
-		PTOK(pthread_cond_signal(&exphdl->condvar));
+		PTOK(pthread_cond_signal(&ep->condvar));
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Add the shard's pending counts to the main counters
+ */
+
+static void
+exp_sumstat(struct exp_priv *ep, vtim_real now)
+{
+
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+	Lck_AssertHeld(&ep->mtx);
+
+	Lck_Lock(&exp_stat_mtx);
+	VSC_C_main->exp_mailed += ep->mailed;
+	VSC_C_main->exp_received += ep->received;
+	VSC_C_main->n_superseded += ep->superseded;
+	VSC_C_main->n_expired += ep->expired;
+	VSC_C_main->n_stale_kept += ep->stale_kept;
+	Lck_Unlock(&exp_stat_mtx);
+	ep->mailed = 0;
+	ep->received = 0;
+	ep->superseded = 0;
+	ep->expired = 0;
+	ep->stale_kept = 0;
+	ep->t_sumstat = now;
+}
+
 /*--------------------------------------------------------------------
  * Setup a new ObjCore for control by expire. Should be called with the
  * ObjHead locked by HSH_Unbusy(/HSH_Insert) (in private access).
@@ -138,7 +198,7 @@ EXP_RefNewObjcore(struct objcore *oc)
 
 	AZ(oc->exp_flags);
 	assert(oc->refcnt >= 1);
-	oc->refcnt++;
+	OC_REF(oc);
 	oc->exp_flags |= OC_EF_REFD | OC_EF_NEW;
 }
 
@@ -152,13 +212,16 @@ void
 EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 {
 
+	struct exp_priv *ep;
+
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_ORNULL(new_oc, OBJCORE_MAGIC);
 
 	if (oc->exp_flags & OC_EF_REFD) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_shard(oc);
+		Lck_Lock(&ep->mtx);
 		if (new_oc != NULL)
-			VSC_C_main->n_superseded++;
+			ep->superseded++;
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called for this object
 			 * yet. Mark it for removal, and EXP_Insert will
@@ -166,8 +229,8 @@ EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 			AZ(oc->exp_flags & OC_EF_POSTED);
 			oc->exp_flags |= OC_EF_REMOVE;
 		} else
-			exp_mail_it(oc, OC_EF_REMOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_REMOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
@@ -182,6 +245,7 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 {
 	unsigned remove_race = 0;
 	struct objcore *tmpoc;
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -197,7 +261,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 
 	ObjSendEvent(wrk, oc, OEV_INSERT);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_shard(oc);
+	Lck_Lock(&ep->mtx);
 	AN(oc->exp_flags & OC_EF_NEW);
 	oc->exp_flags &= ~OC_EF_NEW;
 	AZ(oc->exp_flags & (OC_EF_INSERT | OC_EF_MOVE | OC_EF_POSTED));
@@ -206,8 +271,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 		remove_race = 1;
 		oc->exp_flags &= ~(OC_EF_REFD | OC_EF_REMOVE);
 	} else
-		exp_mail_it(oc, OC_EF_INSERT | OC_EF_MOVE);
-	Lck_Unlock(&exphdl->mtx);
+		exp_mail_it(ep, oc, OC_EF_INSERT | OC_EF_MOVE);
+	Lck_Unlock(&ep->mtx);
 
 	if (remove_race) {
 		ObjSendEvent(wrk, oc, OEV_EXPIRE);
@@ -250,6 +315,7 @@ void
 EXP_Rearm(struct objcore *oc, vtim_real now,
     vtim_dur ttl, vtim_dur grace, vtim_dur keep)
 {
+	struct exp_priv *ep;
 	vtim_real when;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -271,14 +337,15 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
 	    oc->timer_when, when, oc->flags);
 
 	if (when < oc->t_origin || when < oc->timer_when) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_shard(oc);
+		Lck_Lock(&ep->mtx);
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called yet, do nothing
 			 * as the initial insert will execute the move
 			 * operation. */
 		} else
-			exp_mail_it(oc, OC_EF_MOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_MOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
@@ -301,6 +368,7 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, vtim_real now
 		if (!(flags & OC_EF_INSERT)) {
 			assert(oc->timer_idx != VBH_NOIDX);
 			VBH_delete(ep->heap, oc->timer_idx);
+			ep->stats->objects--;
 		}
 		assert(oc->timer_idx == VBH_NOIDX);
 		assert(oc->refcnt > 0);
@@ -329,11 +397,12 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, vtim_real now
 
 	if (flags & OC_EF_INSERT) {
 		assert(oc->timer_idx == VBH_NOIDX);
-		VBH_insert(exphdl->heap, oc);
+		VBH_insert(ep->heap, oc);
 		assert(oc->timer_idx != VBH_NOIDX);
+		ep->stats->objects++;
 	} else if (flags & OC_EF_MOVE) {
 		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_reorder(exphdl->heap, oc->timer_idx);
+		VBH_reorder(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx != VBH_NOIDX);
 	} else {
 		WRONG("Objcore state wrong in inbox");
@@ -365,11 +434,12 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 
 	/* In stale_indefinitely mode, never expire objects based on time */
 	if (FEATURE(FEATURE_STALE_INDEFINITELY)) {
-		VSC_C_main->n_stale_kept++;
+		ep->stale_kept++;
 		return (now + 355. / 113.);
 	}
 
-	VSC_C_main->n_expired++;
+	ep->expired++;
+	ep->stats->expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -387,6 +457,7 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 		assert(oc->timer_idx != VBH_NOIDX);
 		VBH_delete(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx == VBH_NOIDX);
+		ep->stats->objects--;
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%ju t=%.0f h=%jd",
@@ -442,13 +513,17 @@ exp_thread(struct worker *wrk, void *priv)
 	while (exp_shutdown == 0) {
 
 		Lck_Lock(&ep->mtx);
+		if (t > ep->t_sumstat + 1.)
+			exp_sumstat(ep, t);
 		oc = VSTAILQ_FIRST(&ep->inbox);
 		CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			assert(oc->exp_flags & OC_EF_POSTED);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			ep->stats->received++;
+			ep->stats->inbox--;
+			ep->received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
@@ -457,6 +532,7 @@ exp_thread(struct worker *wrk, void *priv)
 				oc->exp_flags &= OC_EF_REFD;
 		} else if (tnext > t) {
 			VSL_Flush(&ep->vsl, 0);
+			exp_sumstat(ep, t);
 			Pool_Sumstat(wrk);
 			(void)Lck_CondWaitUntil(&ep->condvar, &ep->mtx, tnext);
 		}
@@ -480,33 +556,55 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	PTOK(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
-	ep->thread = pt;
-	exphdl = ep;
+	unsigned u;
+
+	exp_nshards = cache_param->expiry_shards;
+	assert(exp_nshards > 0);
+	exphdl = calloc(exp_nshards, sizeof *exphdl);
+	AN(exphdl);
+	Lck_New(&exp_stat_mtx, lck_exp);
+
+	for (u = 0; u < exp_nshards; u++) {
+		ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
+		AN(ep);
+
+		Lck_New(&ep->mtx, lck_exp);
+		PTOK(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		ep->stats = VSC_exp_New(NULL, NULL, "%u", u);
+		AN(ep->stats);
+		if (u == 0)
+			bprintf(ep->name, "%s", "cache-exp");
+		else
+			bprintf(ep->name, "cache-exp-%u", u);
+		exphdl[u] = ep;
+		WRK_BgThread(&pt, ep->name, exp_thread, ep);
+		ep->thread = pt;
+	}
 }
 
 void
 EXP_Shutdown(void)
 {
-	struct exp_priv *ep = exphdl;
+	struct exp_priv *ep;
 	void *status;
+	unsigned u;
 
-	Lck_Lock(&ep->mtx);
-	exp_shutdown = 1;
-	PTOK(pthread_cond_signal(&ep->condvar));
-	Lck_Unlock(&ep->mtx);
+	for (u = 0; u < exp_nshards; u++) {
+		ep = exphdl[u];
+		Lck_Lock(&ep->mtx);
+		exp_shutdown = 1;
+		PTOK(pthread_cond_signal(&ep->condvar));
+		Lck_Unlock(&ep->mtx);
+	}
 
-	AN(ep->thread);
-	PTOK(pthread_join(ep->thread, &status));
-	AZ(status);
-	memset(&ep->thread, 0, sizeof ep->thread);
+	for (u = 0; u < exp_nshards; u++) {
+		ep = exphdl[u];
+		AN(ep->thread);
+		PTOK(pthread_join(ep->thread, &status));
+		AZ(status);
+		memset(&ep->thread, 0, sizeof ep->thread);
+	}
 
 	/* XXX could cleanup more - not worth it for now */
 }
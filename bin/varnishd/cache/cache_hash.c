@@ -169,6 +169,7 @@ HSH_Private(const struct worker *wrk)
 	oc->flags |= OC_F_PRIVATE;
 	Lck_Lock(&oh->mtx);
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
+	oh->n_objcs++;
 	oh->refcnt++;
 	Lck_Unlock(&oh->mtx);
 	return (oc);
@@ -206,6 +207,8 @@ HSH_DeleteObjHead(const struct worker *wrk, struct objhead *oh)
 
 	AZ(oh->refcnt);
 	assert(VTAILQ_EMPTY(&oh->objcs));
+	AZ(oh->n_objcs);
+	AZ(oh->vary_idx);
 	assert(VTAILQ_EMPTY(&oh->waitinglist));
 	Lck_Delete(&oh->mtx);
 	wrk->stats->n_objecthead--;
@@ -335,6 +338,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	   objecthead. The new object inherits our objhead reference. */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
+	oh->n_objcs++;
 	EXP_RefNewObjcore(oc);
 	Lck_Unlock(&oh->mtx);
 
@@ -346,6 +350,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	Lck_Lock(&oh->mtx);
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	VRY_IdxInsert(wrk, oh, oc);
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
 		hsh_rush1(wrk, oc, &rush);
 	Lck_Unlock(&oh->mtx);
@@ -358,7 +363,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
  */
 
 static struct objcore *
-hsh_insert_busyobj(const struct worker *wrk, struct objhead *oh)
+hsh_insert_busyobj(struct worker *wrk, struct objhead *oh)
 {
 	struct objcore *oc;
 
@@ -376,9 +381,23 @@ hsh_insert_busyobj(const struct worker *wrk, struct objhead *oh)
 	oc->refcnt = 1;		/* Owned by busyobj */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
+	oh->n_objcs++;
+	VRY_IdxInsert(wrk, oh, oc);
 	return (oc);
 }
 
+/*---------------------------------------------------------------------
+ * hits is only 32 bits, saturate rather than report 0 for hot objects
+ */
+
+static inline void
+hsh_hit(struct objcore *oc)
+{
+
+	if (oc->hits < UINT32_MAX)
+		oc->hits++;
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -430,6 +449,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	struct objhead *oh;
 	struct objcore *oc;
 	struct objcore *exp_oc;
+	struct objcore *cand[VRY_IDX_MAXCAND];
 	const struct vcf_return *vr;
 	vtim_real exp_t_origin;
 	int busy_found;
@@ -437,6 +457,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	unsigned xid = 0;
 	unsigned ban_checks;
 	unsigned ban_any_variant;
+	int ncand, icand;
 	float dttl = 0.0;
 
 	AN(ocp);
@@ -468,7 +489,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		*ocp = oc;
 		oh = oc->objhead;
 		Lck_Lock(&oh->mtx);
-		oc->hits++;
+		hsh_hit(oc);
 		boc_progress = oc->boc == NULL ? -1 : oc->boc->fetched_so_far;
 		AN(hsh_deref_objhead_unlock(wrk, &oh, oc));
 		Req_LogHit(wrk, req, oc, boc_progress);
@@ -507,7 +528,24 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	exp_t_origin = 0.0;
 	ban_checks = 0;
 	ban_any_variant = cache_param->ban_any_variant;
-	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
+
+	/*
+	 * With a vary index, only examine the objcores which can match.
+	 * Non-matching variants are only of interest to VCF and when
+	 * checking bans on any variant.
+	 */
+	ncand = -1;
+	if (oh->vary_idx != NULL && !req->hash_ignore_vary &&
+	    req->vcf == NULL && ban_any_variant == 0)
+		ncand = VRY_IdxLookup(req, oh, cand, vcountof(cand));
+	icand = 0;
+	if (ncand >= 0)
+		oc = ncand > 0 ? cand[0] : NULL;
+	else
+		oc = VTAILQ_FIRST(&oh->objcs);
+	for (; oc != NULL; oc = ncand >= 0 ?
+	    (++icand < ncand ? cand[icand] : NULL) :
+	    VTAILQ_NEXT(oc, hsh_list)) {
 		/* Must be at least our own ref + the objcore we examine */
 		assert(oh->refcnt > 1);
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -600,7 +638,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 
 	if (oc != NULL) {
 		*ocp = oc;
-		oc->refcnt++;
+		OC_REF(oc);
 		if (oc->flags & OC_F_HFM) {
 			xid = VXID(ObjGetXID(wrk, oc));
 			dttl = EXP_Dttl(req, oc);
@@ -610,7 +648,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 			VSLb(req->vsl, SLT_HitMiss, "%u %.6f", xid, dttl);
 			return (HSH_HITMISS);
 		}
-		oc->hits++;
+		hsh_hit(oc);
 		boc_progress = oc->boc == NULL ? -1 : oc->boc->fetched_so_far;
 		AN(hsh_deref_objhead_unlock(wrk, &oh, oc));
 		Req_LogHit(wrk, req, oc, boc_progress);
@@ -642,10 +680,10 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		*bocp = hsh_insert_busyobj(wrk, oh);
 
 		if (exp_oc != NULL) {
-			exp_oc->refcnt++;
+			OC_REF(exp_oc);
 			*ocp = exp_oc;
 			if (EXP_Ttl_grace(req, exp_oc) >= req->t_req) {
-				exp_oc->hits++;
+				hsh_hit(exp_oc);
 				Lck_Unlock(&oh->mtx);
 				Req_LogHit(wrk, req, exp_oc, boc_progress);
 				return (HSH_GRACE);
@@ -658,9 +696,9 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 	AN(busy_found);
 	if (exp_oc != NULL && EXP_Ttl_grace(req, exp_oc) >= req->t_req) {
 		/* we do not wait on the busy object if in grace */
-		exp_oc->refcnt++;
+		OC_REF(exp_oc);
 		*ocp = exp_oc;
-		exp_oc->hits++;
+		hsh_hit(exp_oc);
 		AN(hsh_deref_objhead_unlock(wrk, &oh, NULL));
 		Req_LogHit(wrk, req, exp_oc, boc_progress);
 		return (HSH_GRACE);
@@ -751,7 +789,7 @@ hsh_rush1(const struct worker *wrk, struct objcore *oc, struct rush *r)
 		VTAILQ_REMOVE(&oh->waitinglist, req, w_list);
 		VTAILQ_INSERT_TAIL(&r->reqs, req, w_list);
 		req->objcore = oc;
-		oc->refcnt++;
+		OC_REF(oc);
 		wrk->stats->busy_wakeup++;
 	}
 }
@@ -844,7 +882,7 @@ HSH_Purge(struct worker *wrk, struct objhead *oh, vtim_real ttl_now,
 				continue;
 			if (is_purge)
 				oc->flags |= OC_F_DYING;
-			oc->refcnt++;
+			OC_REF(oc);
 			ocp[n++] = oc;
 		}
 
@@ -1070,6 +1108,7 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
+	VRY_IdxInsert(wrk, oh, oc);
 	if (!VTAILQ_EMPTY(&oh->waitinglist)) {
 		assert(oh->refcnt > 1);
 		hsh_rush1(wrk, oc, &rush);
@@ -1127,7 +1166,7 @@ HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 	if (oc->refcnt == 1 && !Lck_Trylock(&oc->objhead->mtx)) {
 		if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
 			oc->flags |= OC_F_DYING;
-			oc->refcnt++;
+			OC_REF(oc);
 			retval = 1;
 		}
 		Lck_Unlock(&oc->objhead->mtx);
@@ -1152,7 +1191,7 @@ HSH_Ref(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_Lock(&oh->mtx);
 	assert(oc->refcnt > 0);
-	oc->refcnt++;
+	OC_REF(oc);
 	Lck_Unlock(&oh->mtx);
 }
 
@@ -1218,6 +1257,7 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp)
 {
 	struct objcore *oc;
 	struct objhead *oh;
+	int r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	TAKE_OBJ_NOTNULL(oc, ocp, OBJCORE_MAGIC);
@@ -1226,6 +1266,20 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp)
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
+	/*
+	 * Unless this is the last reference, nothing needs to be done
+	 * under the objhead lock. This keeps hits on hot objects from
+	 * taking the lock a second time when they are done.
+	 */
+	r = __atomic_load_n(&oc->refcnt, __ATOMIC_RELAXED);
+	while (r > 1) {
+		if (__atomic_compare_exchange_n(&oc->refcnt, &r, r - 1, 1,
+		    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			wrk->stats->n_objcore_deref_unlocked++;
+			return (r - 1);
+		}
+	}
+
 	Lck_Lock(&oh->mtx);
 	return (hsh_deref_objcore_unlock(wrk, &oc));
 }
@@ -1246,9 +1300,13 @@ hsh_deref_objcore_unlock(struct worker *wrk, struct objcore **ocp)
 
 	Lck_AssertHeld(&oh->mtx);
 	assert(oh->refcnt > 0);
-	r = --oc->refcnt;
-	if (!r)
+	r = __atomic_sub_fetch(&oc->refcnt, 1, __ATOMIC_ACQ_REL);
+	if (!r) {
 		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
+		assert(oh->n_objcs > 0);
+		oh->n_objcs--;
+		VRY_IdxRemove(wrk, oh, oc);
+	}
 	Lck_Unlock(&oh->mtx);
 	if (r != 0)
 		return (r);
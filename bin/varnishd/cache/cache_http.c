@@ -79,6 +79,10 @@ static char * via_hdr;
 #define GPERF_MAX_WORD_LENGTH 19
 #define GPERF_MAX_HASH_VALUE 79
 
+#if GPERF_MAX_HASH_VALUE + 1 != HTTP_HDX_SZ
+#  error "HTTP_HDX_SZ does not match the perfect hash"
+#endif
+
 static const unsigned char http_asso_values[256] = {
 	80, 80, 80, 80, 80, 80, 80, 80, 80, 80,
 	80, 80, 80, 80, 80, 80, 80, 80, 80, 80,
@@ -203,6 +207,58 @@ http_hdr_flags(const char *b, const char *e)
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * The header index hp->hdx[] holds the position of the first instance
+ * of each header in the perfect hash above, or zero if there is none,
+ * such that http_findhdr() need not scan for well-known headers.
+ *
+ * Code appending headers behind our back calls HTTP_IndexHdr(), code
+ * moving or removing headers calls HTTP_Reindex() for the first position
+ * it touched.
+ */
+
+static unsigned
+http_hdx_slot(const txt *t)
+{
+	struct http_hdrflg *f;
+	const char *e;
+
+	Tcheck(*t);
+	e = memchr(t->b, ':', vmin_t(size_t, Tlen(*t),
+	    GPERF_MAX_WORD_LENGTH + 1));
+	f = http_hdr_flags(t->b, e);
+	if (f == NULL)
+		return (HTTP_HDX_SZ);
+	return (f - http_hdrflg);
+}
+
+void
+HTTP_IndexHdr(struct http *hp, unsigned u)
+{
+	unsigned h;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	assert(u >= HTTP_HDR_FIRST);
+	assert(u < hp->nhd);
+	h = http_hdx_slot(&hp->hd[u]);
+	if (h < HTTP_HDX_SZ && (hp->hdx[h] == 0 || hp->hdx[h] > u))
+		hp->hdx[h] = (uint16_t)u;
+}
+
+void
+HTTP_Reindex(struct http *hp, unsigned from)
+{
+	unsigned h, u;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	assert(from >= HTTP_HDR_FIRST);
+	for (h = 0; h < HTTP_HDX_SZ; h++)
+		if (hp->hdx[h] >= from)
+			hp->hdx[h] = 0;
+	for (u = from; u < hp->nhd; u++)
+		HTTP_IndexHdr(hp, u);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -395,6 +451,7 @@ HTTP_Dup(struct http *to, const struct http * fm)
 	memcpy(to->hd, fm->hd, fm->nhd * sizeof *to->hd);
 	memcpy(to->hdf, fm->hdf, fm->nhd * sizeof *to->hdf);
 	to->nhd = fm->nhd;
+	memcpy(to->hdx, fm->hdx, sizeof to->hdx);
 	to->logtag = fm->logtag;
 	to->status = fm->status;
 	to->protover = fm->protover;
@@ -442,8 +499,8 @@ http_Proto(struct http *to)
 
 /*--------------------------------------------------------------------*/
 
-void
-http_SetH(struct http *to, unsigned n, const char *header)
+static void
+http_seth(struct http *to, unsigned n, const char *header)
 {
 
 	assert(n < to->nhd);
@@ -452,6 +509,31 @@ http_SetH(struct http *to, unsigned n, const char *header)
 	to->hd[n].e = strchr(to->hd[n].b, '\0');
 	to->hdf[n] = 0;
 	http_VSLH(to, n);
+}
+
+/*
+ * Appending cannot move the first instance of any header, and nothing in
+ * hdx[] points at or beyond nhd, so the new header only needs indexing.
+ */
+
+static void
+http_addh(struct http *to, const char *header)
+{
+	unsigned n;
+
+	n = to->nhd++;
+	assert(n >= HTTP_HDR_FIRST);
+	http_seth(to, n, header);
+	HTTP_IndexHdr(to, n);
+}
+
+void
+http_SetH(struct http *to, unsigned n, const char *header)
+{
+
+	http_seth(to, n, header);
+	if (n >= HTTP_HDR_FIRST)
+		HTTP_Reindex(to, n);
 	if (n == HTTP_HDR_PROTO)
 		http_Proto(to);
 	if (n == HTTP_HDR_METHOD)
@@ -491,8 +573,21 @@ http_IsHdr(const txt *hh, hdr_t hdr)
 static unsigned
 http_findhdr(const struct http *hp, unsigned l, const char *hdr)
 {
+	const struct http_hdrflg *f;
 	unsigned u;
 
+	f = http_hdr_flags(hdr, hdr + l);
+	if (f != NULL) {
+		u = hp->hdx[f - http_hdrflg];
+		if (u != 0) {
+			assert(u < hp->nhd);
+			Tcheck(hp->hd[u]);
+			assert(hp->hd[u].b[l] == ':');
+			assert(http_hdr_at(hdr, hp->hd[u].b, l));
+		}
+		return (u);
+	}
+
 	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (hp->hd[u].e < hp->hd[u].b + l + 1)
@@ -586,6 +681,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 				VSLbs(hp->vsl, SLT_LostHeader,
 				    TOSTRAND(hdr->str));
 				WS_Release(hp->ws, 0);
+				HTTP_Reindex(hp, f + 1);
 				return;
 			}
 			memcpy(b, hp->hd[f].b, x);
@@ -608,6 +704,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 			http_fail(hp);
 			VSLbs(hp->vsl, SLT_LostHeader, TOSTRAND(hdr->str));
 			WS_Release(hp->ws, 0);
+			HTTP_Reindex(hp, f + 1);
 			return;
 		}
 		memcpy(b, sep, lsep);
@@ -618,6 +715,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 	if (b == NULL)
 		return;
 	hp->nhd = (uint16_t)d;
+	HTTP_Reindex(hp, f + 1);
 	AN(e);
 	*b = '\0';
 	hp->hd[f].b = WS_Reservation(hp->ws);
@@ -1302,14 +1400,17 @@ HTTP_Decode(struct http *to, const uint8_t *fm)
 				to->hd[to->nhd].e = NULL;
 				continue;
 			}
-			if (*fm == '\0')
+			if (*fm == '\0') {
+				HTTP_Reindex(to, HTTP_HDR_FIRST);
 				return (0);
+			}
 			to->hd[to->nhd].b = (const void*)fm;
 			fm = (const void*)strchr((const void*)fm, '\0');
 			to->hd[to->nhd].e = (const void*)fm;
 			fm++;
 			http_VSLH(to, to->nhd);
 		}
+		HTTP_Reindex(to, HTTP_HDR_FIRST);
 	}
 	VSLb(to->vsl, SLT_Error,
 	    "Too many headers to Decode object (%u vs. %u)",
@@ -1477,6 +1578,7 @@ http_FilterReq(struct http *to, const struct http *fm, unsigned how)
 		http_VSLH(to, to->nhd);
 		to->nhd++;
 	}
+	HTTP_Reindex(to, HTTP_HDR_FIRST);
 }
 
 /*--------------------------------------------------------------------
@@ -1523,7 +1625,7 @@ http_SetHeader(struct http *to, const char *header)
 		http_fail(to);
 		return;
 	}
-	http_SetH(to, to->nhd++, header);
+	http_addh(to, header);
 }
 
 /*--------------------------------------------------------------------*/
@@ -1574,7 +1676,7 @@ http_PrintfHeader(struct http *to, const char *fmt, ...)
 		http_fail(to);
 		VSLbv(to->vsl, SLT_LostHeader, fmt, ap2);
 	} else {
-		http_SetH(to, to->nhd++, p);
+		http_addh(to, p);
 	}
 	va_end(ap);
 	va_end(ap2);
@@ -1599,7 +1701,7 @@ http_TimeHeader(struct http *to, const char *fmt, vtim_real now)
 	}
 	strcpy(p, fmt);
 	VTIM_format(now, strchr(p, '\0'));
-	http_SetH(to, to->nhd++, p);
+	http_addh(to, p);
 }
 
 const char *
@@ -1614,9 +1716,13 @@ http_ViaHeader(void)
 void
 http_Unset(struct http *hp, hdr_t hdr)
 {
-	uint16_t u, v;
+	uint16_t f, u, v;
 
-	for (v = u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+	CHECK_HDR(hdr);
+	f = (uint16_t)http_findhdr(hp, hdr->len - 1, hdr->str);
+	if (f == 0)
+		return;
+	for (v = u = f; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (http_IsHdr(&hp->hd[u], hdr)) {
 			http_VSLH_del(hp, u);
@@ -1629,6 +1735,7 @@ http_Unset(struct http *hp, hdr_t hdr)
 		v++;
 	}
 	hp->nhd = v;
+	HTTP_Reindex(hp, f);
 }
 
 void
@@ -88,8 +88,11 @@
 #include "cache_obj.h"
 #include "cache_objhead.h"
 #include "vend.h"
+#include "vtim.h"
 #include "storage/storage.h"
 
+vtim_real oc_epoch;
+
 static const struct obj_methods *
 obj_getmethods(const struct objcore *oc)
 {
@@ -140,7 +143,8 @@ ObjNew(const struct worker *wrk)
 	ALLOC_OBJ(oc, OBJCORE_MAGIC);
 	AN(oc);
 	wrk->stats->n_objectcore++;
-	oc->last_lru = NAN;
+	wrk->stats->g_objectcore_bytes += sizeof *oc;
+	oc->last_lru = OC_TS_NONE;
 	oc->boc = obj_newboc();
 
 	return (oc);
@@ -162,6 +166,7 @@ ObjDestroy(const struct worker *wrk, struct objcore **p)
 		obj_deleteboc(&oc->boc);
 	FREE_OBJ(oc);
 	wrk->stats->n_objectcore--;
+	wrk->stats->g_objectcore_bytes -= sizeof *oc;
 }
 
 /*====================================================================
@@ -242,6 +247,11 @@ ObjIterate(struct worker *wrk, struct objcore *oc,
  *	ObjVAIreturn() may retain leases in the vscaret if the implementation
  *	still requires them, iow, the vscaret might not be empty upon return.
  *
+ * ObjVAIfd() returns a file descriptor and sets the offset to read the
+ *	data of a viov from, as received from ObjVAIlease(), or -1 if the
+ *	storage can not provide one. The file descriptor must only be used
+ *	until the lease is returned.
+ *
  * ObjVAIfini() finalized iteration
  *
  *	it must be called when iteration is done, irrespective of error status
@@ -293,6 +303,20 @@ ObjVAIreturn(struct worker *wrk, vai_hdl vhdl, struct vscaret *scaret)
 	vaip->vai_return(wrk, vhdl, scaret);
 }
 
+int
+ObjVAIfd(struct worker *wrk, vai_hdl vhdl, const struct viov *viov, off_t *off)
+{
+	struct vai_hdl_preamble *vaip = vhdl;
+
+	AN(vaip);
+	assert(vaip->magic2 == VAI_HDL_PREAMBLE_MAGIC2);
+	AN(viov);
+	AN(off);
+	if (vaip->vai_fd == NULL)
+		return (-1);
+	return (vaip->vai_fd(wrk, vhdl, viov, off));
+}
+
 void
 ObjVAIfini(struct worker *wrk, vai_hdl *vhdlp)
 {
@@ -952,6 +976,7 @@ ObjSendEvent(struct worker *wrk, struct objcore *oc, unsigned event)
 void
 ObjInit(void)
 {
+	oc_epoch = VTIM_real();
 	VTAILQ_INIT(&oev_list);
 	PTOK(pthread_rwlock_init(&oev_rwl, NULL));
 }
@@ -120,6 +120,16 @@ typedef int vai_buffer_f(struct worker *, vai_hdl, struct vscarab *);
  */
 typedef void vai_return_f(struct worker *, vai_hdl, struct vscaret *);
 
+/*
+ * optional: get a file descriptor and offset to read the data of a viov
+ * from, as leased by vai_lease_f
+ *
+ * return:
+ * -1:		no file descriptor available for this viov
+ * fd:		valid until the lease is returned, *off is set
+ */
+typedef int vai_fd_f(struct worker *, vai_hdl, const struct viov *, off_t *);
+
 /*
  * finish iteration, vai_return_f must have been called on all leases
  */
@@ -142,7 +152,8 @@ struct vai_hdl_preamble {
 	vai_lease_f	*vai_lease;
 	vai_buffer_f	*vai_buffer;
 	vai_return_f	*vai_return;
-	uintptr_t	reserve[4];	// abi fwd compat
+	vai_fd_f	*vai_fd;	// optional
+	uintptr_t	reserve[3];	// abi fwd compat
 	vai_fini_f	*vai_fini;
 };
 
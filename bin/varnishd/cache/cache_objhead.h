@@ -38,10 +38,12 @@ struct objhead {
 
 	int			refcnt;
 	struct lock		mtx;
-	VTAILQ_HEAD(,objcore)	objcs;
+	VTAILQ_HEAD(objcorehead, objcore) objcs;
 	uint8_t			digest[DIGEST_LEN];
 	unsigned		waitinglist_gen;
+	unsigned		n_objcs;
 	VTAILQ_HEAD(, req)	waitinglist;
+	struct vry_idx		*vary_idx;
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
@@ -57,6 +59,14 @@ struct objhead {
 #define hoh_head _u.n.u_n_hoh_head
 };
 
+/*
+ * References on an objcore are taken with the objhead locked, but all
+ * except the last one can be dropped without the lock, see
+ * HSH_DerefObjCore(). Hence all changes to oc->refcnt must be atomic.
+ */
+#define OC_REF(oc) \
+	((void)__atomic_add_fetch(&(oc)->refcnt, 1, __ATOMIC_RELAXED))
+
 enum lookup_e {
 	HSH_MISS,
 	HSH_HITMISS,
@@ -85,3 +95,10 @@ unsigned HSH_Purge(struct worker *, struct objhead *, vtim_real ttl_now,
     vtim_dur ttl, vtim_dur grace, vtim_dur keep);
 struct objcore *HSH_Private(const struct worker *wrk);
 void HSH_Cancel(struct worker *, struct objcore *, struct boc *);
+
+/* cache_vary.c */
+#define VRY_IDX_MAXCAND		64
+void VRY_IdxInsert(struct worker *, struct objhead *, struct objcore *);
+void VRY_IdxRemove(struct worker *, struct objhead *, const struct objcore *);
+int VRY_IdxLookup(const struct req *, const struct objhead *,
+    struct objcore **, unsigned);
@@ -33,15 +33,28 @@
  * Pools can be added on the fly, as a means to mitigate lock contention,
  * but can only be removed again by a restart. (XXX: we could fix that)
  *
+ * With thread_pool_affinity, the pool_poolherder binds itself to the CPUs
+ * of a pool while creating it, such that all threads of the pool inherit
+ * the binding.
  */
 
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP)
+#  include <sched.h>
+#  if defined(HAVE_PTHREAD_NP_H)
+#    include <pthread_np.h>
+#  endif
+#endif
 
 #include "cache_varnishd.h"
 #include "cache_pool.h"
 
+#include "vfil.h"
 #include "vtim.h"
 
 static pthread_t		thr_pool_herder;
@@ -97,6 +110,30 @@ Pool_Task_Any(struct pool_task *task, enum task_prio prio)
 	return (Pool_Task(pp, task, prio));
 }
 
+/*--------------------------------------------------------------------
+ * The pool after pp, wrapping around, or NULL if pp is the only one.
+ * Pools are only freed with pool_mtx held.
+ *
+ * A new pool already runs tasks before pool_poolherder() puts it on the
+ * list, so the list can be empty or not contain pp.
+ */
+
+struct pool *
+pool_next(const struct pool *pp)
+{
+	struct pool *pp2;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pool_mtx);
+	pp2 = VTAILQ_NEXT(pp, list);
+	if (pp2 == NULL)
+		pp2 = VTAILQ_FIRST(&pools);
+	if (pp2 == NULL || pp2 == pp)
+		return (NULL);
+	CHECK_OBJ(pp2, POOL_MAGIC);
+	return (pp2);
+}
+
 /*--------------------------------------------------------------------
  * Helper function to update stats for purges under lock
  */
@@ -141,6 +178,123 @@ pool_stat_summ(struct worker *wrk, void *priv)
 	pp->b_stat = src;
 }
 
+/*--------------------------------------------------------------------
+ * CPU affinity of pools
+ */
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP)
+
+#define POOL_NODE_CPULIST "/sys/devices/system/node/node%u/cpulist"
+
+static cpu_set_t pool_cpus;
+
+static void
+pool_cpulist(cpu_set_t *set, const char *s)
+{
+	unsigned long a, b;
+	char *e;
+
+	CPU_ZERO(set);
+	while (*s != '\0' && *s != '\n') {
+		a = strtoul(s, &e, 10);
+		if (e == s)
+			break;
+		b = a;
+		if (*e == '-') {
+			s = e + 1;
+			b = strtoul(s, &e, 10);
+			if (e == s)
+				break;
+		}
+		for (; a <= b && a < CPU_SETSIZE; a++)
+			CPU_SET(a, set);
+		s = e;
+		if (*s == ',')
+			s++;
+	}
+}
+
+/*
+ * Pools go to the NUMA nodes in turn, and if there is only one node, get
+ * a contiguous share of the CPUs we were started with.
+ */
+
+static void
+pool_cpuset(unsigned pool_no, cpu_set_t *set)
+{
+	char fn[sizeof POOL_NODE_CPULIST + 10];
+	cpu_set_t node;
+	unsigned nnode, ncpu, npools, u, k;
+	char *buf;
+
+	for (nnode = 0; ; nnode++) {
+		bprintf(fn, POOL_NODE_CPULIST, nnode);
+		if (access(fn, R_OK))
+			break;
+	}
+	if (nnode > 1) {
+		bprintf(fn, POOL_NODE_CPULIST, pool_no % nnode);
+		buf = VFIL_readfile(NULL, fn, NULL);
+		if (buf != NULL) {
+			pool_cpulist(&node, buf);
+			free(buf);
+			CPU_AND(set, &node, &pool_cpus);
+			if (CPU_COUNT(set) > 0)
+				return;
+		}
+	}
+
+	ncpu = CPU_COUNT(&pool_cpus);
+	assert(ncpu > 0);
+	npools = vmin_t(unsigned, cache_param->wthread_pools, ncpu);
+	CPU_ZERO(set);
+	for (u = k = 0; u < CPU_SETSIZE; u++) {
+		if (!CPU_ISSET(u, &pool_cpus))
+			continue;
+		if (k * npools / ncpu == pool_no % npools)
+			CPU_SET(u, set);
+		k++;
+	}
+}
+
+static void
+pool_bind(unsigned pool_no)
+{
+	cpu_set_t set;
+
+	if (!cache_param->wthread_affinity)
+		return;
+	pool_cpuset(pool_no, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof set, &set))
+		VSL(SLT_Error, NO_VXID, "Could not bind pool %u to %d CPUs",
+		    pool_no, CPU_COUNT(&set));
+}
+
+static void
+pool_unbind(void)
+{
+
+	if (!cache_param->wthread_affinity)
+		return;
+	(void)pthread_setaffinity_np(pthread_self(), sizeof pool_cpus,
+	    &pool_cpus);
+}
+
+#else
+
+static void
+pool_bind(unsigned pool_no)
+{
+	(void)pool_no;
+}
+
+static void
+pool_unbind(void)
+{
+}
+
+#endif
+
 /*--------------------------------------------------------------------
  * Add a thread pool
  */
@@ -154,6 +308,7 @@ pool_mkpool(unsigned pool_no)
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
+	pool_bind(pool_no);
 	pp->a_stat = calloc(1, sizeof *pp->a_stat);
 	AN(pp->a_stat);
 	pp->b_stat = calloc(1, sizeof *pp->b_stat);
@@ -172,6 +327,7 @@ pool_mkpool(unsigned pool_no)
 
 	SES_NewPool(pp, pool_no);
 	VCA_NewPool(pp);
+	pool_unbind();
 
 	return (pp);
 }
@@ -188,7 +344,7 @@ static void * v_matchproto_()
 pool_poolherder(void *priv)
 {
 	unsigned nwq;
-	struct pool *pp, *ppx;
+	struct pool *pp, *ppx, *heir;
 	uint64_t u;
 	void *rvp;
 
@@ -215,13 +371,19 @@ pool_poolherder(void *priv)
 			CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 			VTAILQ_REMOVE(&pools, pp, list);
 			VTAILQ_INSERT_TAIL(&pools, pp, list);
-			if (!pp->die)
+			heir = NULL;
+			if (!pp->die) {
 				nwq--;
+				VTAILQ_FOREACH(heir, &pools, list)
+					if (heir != pp && !heir->die)
+						break;
+				CHECK_OBJ_NOTNULL(heir, POOL_MAGIC);
+			}
 			Lck_Unlock(&pool_mtx);
-			if (!pp->die) {
+			if (heir != NULL) {
 				VSL(SLT_Debug, NO_VXID, "XXX Kill Pool %p", pp);
+				VCA_DestroyPool(pp, heir);
 				pp->die = 1;
-				VCA_DestroyPool(pp);
 				PTOK(pthread_cond_signal(&pp->herder_cond));
 			}
 		}
@@ -282,6 +444,10 @@ Pool_Init(void)
 
 	Lck_New(&wstat_mtx, lck_wstat);
 	Lck_New(&pool_mtx, lck_wq);
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP)
+	PTOK(pthread_getaffinity_np(pthread_self(), sizeof pool_cpus,
+	    &pool_cpus));
+#endif
 	PTOK(pthread_create(&thr_pool_herder, NULL, pool_poolherder, NULL));
 	while (!VSC_C_main->pools)
 		VTIM_sleep(0.01);
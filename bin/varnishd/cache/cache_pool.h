@@ -33,6 +33,9 @@
 
 VTAILQ_HEAD(taskhead, pool_task);
 
+/* Queue wait histogram buckets of 2^n microseconds, see pool_qwait() */
+#define POOL_QWAIT_NBUCKET		25
+
 struct poolsock;
 
 struct pool {
@@ -52,6 +55,9 @@ struct pool {
 	unsigned			nthr;
 	unsigned			lqueue;
 	uintmax_t			ndequeued;
+	unsigned			qwait[TASK_QUEUE_RESERVE]
+					    [POOL_QWAIT_NBUCKET];
+	vtim_mono			qwait_t0;
 	struct VSC_main_pool		stats[1];
 	struct VSC_main_wrk		*a_stat;
 	struct VSC_main_wrk		*b_stat;
@@ -62,7 +68,8 @@ struct pool {
 };
 
 void *pool_herder(void*);
+struct pool *pool_next(const struct pool *);
 task_func_t pool_stat_summ;
 extern struct lock			pool_mtx;
 void VCA_NewPool(struct pool *);
-void VCA_DestroyPool(struct pool *);
+void VCA_DestroyPool(struct pool *, struct pool *);
@@ -0,0 +1,444 @@
+/*-
+ * Copyright 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The tag index maps surrogate keys to the objects carrying them, such
+ * that purging by tag touches only the objects concerned instead of
+ * leaving a ban for the lurker to test against the whole cache.
+ *
+ * Objects are indexed on OEV_INSERT under the whitespace or comma
+ * separated tokens of their xkey and Surrogate-Key headers, and dropped
+ * from the index again on OEV_EXPIRE. Expiry holds a reference on every
+ * object in between, so TAG_Purge() can take references on whatever it
+ * finds in the index without the objhead lock.
+ *
+ * Everything is protected by tag_mtx.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_objhead.h"
+
+#include "hash/hash_slinger.h"
+#include "vcli_serve.h"
+#include "vct.h"
+#include "vtim.h"
+
+static const char * const tag_hdrs[] = {
+	"xkey:",
+	"Surrogate-Key:",
+	NULL
+};
+
+static struct lock tag_mtx;
+
+struct tag_link;
+
+struct tag {
+	unsigned		magic;
+#define TAG_MAGIC		0x5b0e2a71
+	VRBT_ENTRY(tag)		tree;
+	VTAILQ_HEAD(, tag_link)	links;
+	const char		*key;
+	size_t			len;
+	char			buf[];
+};
+
+/* The tags of one object */
+struct tag_oc {
+	unsigned		magic;
+#define TAG_OC_MAGIC		0x2d86c4e9
+	VRBT_ENTRY(tag_oc)	tree;
+	VTAILQ_HEAD(, tag_link)	links;
+	struct objcore		*oc;
+};
+
+struct tag_link {
+	unsigned		magic;
+#define TAG_LINK_MAGIC		0x97f13b0c
+	struct tag		*tag;
+	struct tag_oc		*toc;
+	VTAILQ_ENTRY(tag_link)	tag_list;
+	VTAILQ_ENTRY(tag_link)	oc_list;
+};
+
+static inline int
+tag_cmp(const struct tag *t1, const struct tag *t2)
+{
+	int i;
+
+	i = memcmp(t1->key, t2->key, vmin(t1->len, t2->len));
+	if (i != 0)
+		return (i);
+	if (t1->len != t2->len)
+		return (t1->len < t2->len ? -1 : 1);
+	return (0);
+}
+
+static inline int
+tag_oc_cmp(const struct tag_oc *t1, const struct tag_oc *t2)
+{
+
+	if (t1->oc == t2->oc)
+		return (0);
+	return ((uintptr_t)t1->oc < (uintptr_t)t2->oc ? -1 : 1);
+}
+
+VRBT_HEAD(tag_tree, tag);
+VRBT_GENERATE_REMOVE_COLOR(tag_tree, tag, tree, static)
+VRBT_GENERATE_REMOVE(tag_tree, tag, tree, static)
+VRBT_GENERATE_FIND(tag_tree, tag, tree, tag_cmp, static)
+VRBT_GENERATE_INSERT_COLOR(tag_tree, tag, tree, static)
+VRBT_GENERATE_INSERT_FINISH(tag_tree, tag, tree, static)
+VRBT_GENERATE_INSERT(tag_tree, tag, tree, tag_cmp, static)
+
+VRBT_HEAD(tag_oc_tree, tag_oc);
+VRBT_GENERATE_REMOVE_COLOR(tag_oc_tree, tag_oc, tree, static)
+VRBT_GENERATE_REMOVE(tag_oc_tree, tag_oc, tree, static)
+VRBT_GENERATE_FIND(tag_oc_tree, tag_oc, tree, tag_oc_cmp, static)
+VRBT_GENERATE_INSERT_COLOR(tag_oc_tree, tag_oc, tree, static)
+VRBT_GENERATE_INSERT_FINISH(tag_oc_tree, tag_oc, tree, static)
+VRBT_GENERATE_INSERT(tag_oc_tree, tag_oc, tree, tag_oc_cmp, static)
+
+static struct tag_tree tag_tree = VRBT_INITIALIZER(&tag_tree);
+static struct tag_oc_tree tag_oc_tree = VRBT_INITIALIZER(&tag_oc_tree);
+static unsigned tag_enabled;
+
+/*--------------------------------------------------------------------
+ * Tags are separated by whitespace or commas
+ */
+
+static const char *
+tag_token(const char **pp, size_t *lp)
+{
+	const char *p, *b;
+
+	AN(pp);
+	AN(lp);
+	p = *pp;
+	while (vct_islws(*p) || *p == ',')
+		p++;
+	if (*p == '\0') {
+		*pp = p;
+		return (NULL);
+	}
+	b = p;
+	while (*p != '\0' && !vct_islws(*p) && *p != ',')
+		p++;
+	*lp = p - b;
+	*pp = p;
+	return (b);
+}
+
+static struct tag *
+tag_find(const char *b, size_t l)
+{
+	struct tag needle;
+
+	INIT_OBJ(&needle, TAG_MAGIC);
+	needle.key = b;
+	needle.len = l;
+	return (VRBT_FIND(tag_tree, &tag_tree, &needle));
+}
+
+static void
+tag_index(struct tag_oc **ptoc, struct objcore *oc, const char *v)
+{
+	struct tag_link *tl;
+	struct tag_oc *toc;
+	struct tag *t;
+	const char *b;
+	size_t l;
+
+	AN(ptoc);
+	Lck_AssertHeld(&tag_mtx);
+
+	while ((b = tag_token(&v, &l)) != NULL) {
+		toc = *ptoc;
+		if (toc == NULL) {
+			ALLOC_OBJ(toc, TAG_OC_MAGIC);
+			AN(toc);
+			toc->oc = oc;
+			VTAILQ_INIT(&toc->links);
+			AZ(VRBT_INSERT(tag_oc_tree, &tag_oc_tree, toc));
+			*ptoc = toc;
+		}
+		t = tag_find(b, l);
+		if (t == NULL) {
+			ALLOC_FLEX_OBJ(t, buf, l + 1, TAG_MAGIC);
+			AN(t);
+			memcpy(t->buf, b, l);
+			t->buf[l] = '\0';
+			t->key = t->buf;
+			t->len = l;
+			VTAILQ_INIT(&t->links);
+			AZ(VRBT_INSERT(tag_tree, &tag_tree, t));
+			VSC_C_main->tags_indexed++;
+		} else {
+			VTAILQ_FOREACH(tl, &toc->links, oc_list)
+				if (tl->tag == t)
+					break;
+			if (tl != NULL)
+				continue;
+		}
+		ALLOC_OBJ(tl, TAG_LINK_MAGIC);
+		AN(tl);
+		tl->tag = t;
+		tl->toc = toc;
+		VTAILQ_INSERT_TAIL(&t->links, tl, tag_list);
+		VTAILQ_INSERT_TAIL(&toc->links, tl, oc_list);
+		VSC_C_main->tag_links++;
+	}
+}
+
+static void
+tag_insert(struct worker *wrk, struct objcore *oc)
+{
+	struct tag_oc *toc = NULL;
+	const char *p, *v;
+	const char * const *h;
+
+	if (!ObjHasAttr(wrk, oc, OA_HEADERS))
+		return;
+
+	HTTP_FOREACH_PACK(wrk, oc, p) {
+		for (h = tag_hdrs; *h != NULL; h++)
+			if (http_hdr_at(p, *h, strlen(*h)))
+				break;
+		if (*h == NULL)
+			continue;
+		v = p + strlen(*h);
+		Lck_Lock(&tag_mtx);
+		tag_index(&toc, oc, v);
+		Lck_Unlock(&tag_mtx);
+	}
+}
+
+static void
+tag_remove(struct objcore *oc)
+{
+	struct tag_oc *toc, needle;
+	struct tag_link *tl;
+	struct tag *t;
+
+	INIT_OBJ(&needle, TAG_OC_MAGIC);
+	needle.oc = oc;
+
+	Lck_Lock(&tag_mtx);
+	toc = VRBT_FIND(tag_oc_tree, &tag_oc_tree, &needle);
+	if (toc == NULL) {
+		Lck_Unlock(&tag_mtx);
+		return;
+	}
+	VRBT_REMOVE(tag_oc_tree, &tag_oc_tree, toc);
+	while ((tl = VTAILQ_FIRST(&toc->links)) != NULL) {
+		CHECK_OBJ(tl, TAG_LINK_MAGIC);
+		VTAILQ_REMOVE(&toc->links, tl, oc_list);
+		t = tl->tag;
+		CHECK_OBJ_NOTNULL(t, TAG_MAGIC);
+		VTAILQ_REMOVE(&t->links, tl, tag_list);
+		FREE_OBJ(tl);
+		VSC_C_main->tag_links--;
+		if (!VTAILQ_EMPTY(&t->links))
+			continue;
+		VRBT_REMOVE(tag_tree, &tag_tree, t);
+		FREE_OBJ(t);
+		VSC_C_main->tags_indexed--;
+	}
+	Lck_Unlock(&tag_mtx);
+	FREE_OBJ(toc);
+}
+
+static void v_matchproto_(obj_event_f)
+tag_event(struct worker *wrk, void *priv, struct objcore *oc, unsigned ev)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(priv);
+
+	switch (ev) {
+	case OEV_INSERT:
+		tag_insert(wrk, oc);
+		break;
+	case OEV_EXPIRE:
+		tag_remove(oc);
+		break;
+	default:
+		WRONG("Unexpected oc event");
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Purge all objects carrying any of the tags. With ttl, grace and keep
+ * all zero, this is a hard purge like HSH_Purge(), otherwise the timers
+ * are reduced as by EXP_Reduce(). Returns the number of objects purged
+ * or -1 if the tag index is not enabled.
+ */
+
+static int
+tag_ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t pa, pb;
+
+	pa = *(const uintptr_t *)a;
+	pb = *(const uintptr_t *)b;
+	if (pa == pb)
+		return (0);
+	return (pa < pb ? -1 : 1);
+}
+
+int
+TAG_Purge(struct worker *wrk, const char *tags, vtim_real now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep)
+{
+	struct objcore *oc, **ocs = NULL;
+	struct objhead *oh;
+	struct tag_link *tl;
+	struct tag *t;
+	unsigned u, n = 0, l = 0, total = 0, dying;
+	const char *b;
+	size_t len;
+	int is_purge;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(tags);
+
+	if (!tag_enabled)
+		return (-1);
+
+	is_purge = (ttl == 0 && grace == 0 && keep == 0);
+
+	Lck_Lock(&tag_mtx);
+	VSC_C_main->tag_purges++;
+	while ((b = tag_token(&tags, &len)) != NULL) {
+		t = tag_find(b, len);
+		if (t == NULL)
+			continue;
+		VTAILQ_FOREACH(tl, &t->links, tag_list) {
+			CHECK_OBJ_NOTNULL(tl->toc, TAG_OC_MAGIC);
+			oc = tl->toc->oc;
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			/* Expiry holds a reference while we are indexed */
+			assert(oc->refcnt > 0);
+			if (n == l) {
+				l = l == 0 ? 16 : l * 2;
+				ocs = realloc(ocs, l * sizeof *ocs);
+				AN(ocs);
+			}
+			OC_REF(oc);
+			ocs[n++] = oc;
+		}
+	}
+	Lck_Unlock(&tag_mtx);
+
+	/* Objects with several of the tags get purged once */
+	if (n > 1)
+		qsort(ocs, n, sizeof *ocs, tag_ptr_cmp);
+
+	for (u = 0; u < n; u++) {
+		oc = ocs[u];
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		if (u == 0 || oc != ocs[u - 1]) {
+			if (!is_purge) {
+				EXP_Reduce(oc, now, ttl, grace, keep);
+				total++;
+			} else {
+				oh = oc->objhead;
+				CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+				Lck_Lock(&oh->mtx);
+				dying = oc->flags & OC_F_DYING;
+				oc->flags |= OC_F_DYING;
+				Lck_Unlock(&oh->mtx);
+				if (!dying) {
+					EXP_Remove(oc, NULL);
+					total++;
+				}
+			}
+		}
+		(void)HSH_DerefObjCore(wrk, &oc);
+		AZ(oc);
+	}
+	free(ocs);
+
+	if (is_purge)
+		Pool_PurgeStat(total);
+	return (total);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(cli_func_t)
+ccf_purge_tags(struct cli *cli, const char * const *av, void *priv)
+{
+	struct worker wrk[1];
+	struct worker_priv wpriv[1];
+	struct VSC_main_wrk ds;
+	vtim_real now;
+	int i, n = 0;
+
+	(void)priv;
+
+	if (!tag_enabled) {
+		VCLI_SetResult(cli, CLIS_CANT);
+		VCLI_Out(cli, "The tag index is not enabled (tag_index=off)");
+		return;
+	}
+
+	/* Dropping references can free objects, which needs a worker */
+	INIT_OBJ(wrk, WORKER_MAGIC);
+	INIT_OBJ(wpriv, WORKER_PRIV_MAGIC);
+	wrk->wpriv = wpriv;
+	memset(&ds, 0, sizeof ds);
+	wrk->stats = &ds;
+
+	now = VTIM_real();
+	for (i = 2; av[i] != NULL; i++)
+		n += TAG_Purge(wrk, av[i], now, 0, 0, 0);
+	HSH_Cleanup(wrk);
+	Pool_Sumstat(wrk);
+	VCLI_Out(cli, "%d", n);
+}
+
+static struct cli_proto tag_cmds[] = {
+	{ CLICMD_PURGE_TAGS,			"", ccf_purge_tags },
+	{ NULL }
+};
+
+void
+TAG_Init(void)
+{
+
+	Lck_New(&tag_mtx, Lck_CreateClass(NULL, "tag"));
+	CLI_AddFuncs(tag_cmds);
+	tag_enabled = cache_param->tag_index;
+	if (tag_enabled)
+		(void)ObjSubscribeEvents(tag_event, NULL,
+		    OEV_INSERT | OEV_EXPIRE);
+}
@@ -170,6 +170,8 @@ void BAN_Release(void);
 void BAN_Reload(const uint8_t *ban, unsigned len);
 struct ban *BAN_FindBan(vtim_real t0);
 void BAN_RefBan(struct objcore *oc, struct ban *);
+struct ban *BAN_GrabBan(const struct objcore *oc);
+void BAN_DropBan(struct ban **);
 vtim_real BAN_Time(const struct ban *ban);
 
 /* cache_busyobj.c */
@@ -302,6 +304,8 @@ extern const struct vfp VFP_esi_gzip;
 
 /* cache_http.c */
 void HTTP_Init(void);
+void HTTP_IndexHdr(struct http *, unsigned);
+void HTTP_Reindex(struct http *, unsigned);
 
 /* cache_http1_proto.c */
 
@@ -339,6 +343,20 @@ void *MPL_Get(struct mempool *mpl, unsigned *size);
 void MPL_Free(struct mempool *mpl, void *item);
 
 /* cache_obj.c */
+extern vtim_real oc_epoch;
+/*
+ * Timestamps in struct objcore which do not need full precision, in
+ * deciseconds since the cache process started, rounded down and never
+ * OC_TS_NONE. 100ms is well below lru_interval and the obj.last_hit ban
+ * durations, and 32 bits last for over 13 years of uptime, beyond which
+ * the timestamps stick at the maximum.
+ */
+#define OC_TS_NONE		0U
+#define OC_TS_PACK(t)							\
+	((uint32_t)vlimit_t(double, ((t) - oc_epoch) * 10., 1.,		\
+	    (double)UINT32_MAX))
+#define OC_TS_UNPACK(u)		(oc_epoch + (u) * .1)
+
 void ObjInit(void);
 struct objcore * ObjNew(const struct worker *);
 void ObjDestroy(const struct worker *, struct objcore **);
@@ -481,6 +499,11 @@ void VSL_ChgId(struct vsl_log *vsl, const char *typ, const char *why,
 void VSL_End(struct vsl_log *vsl);
 void VSL_Flush(struct vsl_log *, int overflow);
 
+/* cache_tag.c */
+void TAG_Init(void);
+int TAG_Purge(struct worker *, const char *tags, vtim_real now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep);
+
 /* cache_conn_pool.c */
 struct conn_pool;
 void VCP_Init(void);
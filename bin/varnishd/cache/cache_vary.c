@@ -61,6 +61,7 @@
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
+#include "cache_objhead.h"
 
 #include "vct.h"
 #include "vend.h"
@@ -388,3 +389,409 @@ VRY_Validate(const uint8_t *vary)
 	}
 	return (retval + 3);
 }
+
+/**********************************************************************
+ * Vary index
+ *
+ * For objheads with many variants, an index of the objcores by the hash
+ * of their vary matching string avoids examining every variant on
+ * lookup. Objcores with the same set of Vary header names form a set,
+ * for each of which the request's key is calculated once. Busy objcores
+ * and those without a Vary header are always candidates.
+ *
+ * The key never includes Accept-Encoding, neither its value nor whether
+ * it is present, because vry_cmp() may ignore it depending on
+ * http_gzip_support. Candidates still need to pass VRY_Match(), so this
+ * and hash collisions do no harm.
+ *
+ * All functions are called with the objhead locked.
+ */
+
+struct vry_set {
+	unsigned			magic;
+#define VRY_SET_MAGIC			0x5c0b6d1e
+	unsigned			refcnt;
+	VTAILQ_ENTRY(vry_set)		list;
+	uint8_t				*vary;
+};
+
+struct vry_ient {
+	unsigned			magic;
+#define VRY_IENT_MAGIC			0x2e1f4c8d
+	unsigned			seq;
+	struct objcore			*oc;
+	struct vry_set			*set;
+	uint64_t			key;
+	VTAILQ_ENTRY(vry_ient)		oc_list;
+	VTAILQ_ENTRY(vry_ient)		key_list;
+};
+
+VTAILQ_HEAD(vry_ihead, vry_ient);
+
+struct vry_idx {
+	unsigned			magic;
+#define VRY_IDX_MAGIC			0x6a4e11c3
+	unsigned			bits;
+	unsigned			n;
+	unsigned			seq;
+	struct vry_ihead		*oc_hash;
+	struct vry_ihead		*key_hash;
+	struct vry_ihead		others;
+	VTAILQ_HEAD(, vry_set)		sets;
+};
+
+#define VRY_IDX_MINBITS		6
+
+static inline uint64_t
+vry_fnv(uint64_t h, const void *ptr, size_t l)
+{
+	const uint8_t *p = ptr;
+
+	while (l-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+static inline unsigned
+vry_idx_slot(const struct vry_idx *vi, uint64_t h)
+{
+
+	return ((unsigned)((h * 11400714819323198485ULL) >>
+	    (64 - vi->bits)));
+}
+
+static unsigned
+vry_idx_ocslot(const struct vry_idx *vi, const struct objcore *oc)
+{
+
+	return (vry_idx_slot(vi, (uintptr_t)oc));
+}
+
+/*
+ * Hash one vary entry from the header name part of the matching string
+ * and the contents. Accept-Encoding is left out entirely.
+ */
+
+static uint64_t
+vry_idx_hash(uint64_t h, const uint8_t *hdr, const void *val, unsigned l)
+{
+	uint8_t len[2];
+
+	if (http_hdr_eq(H_Accept_Encoding, (const char *)hdr))
+		return (h);
+	h = vry_fnv(h, hdr, hdr[0] + 2);
+	vbe16enc(len, (uint16_t)l);
+	h = vry_fnv(h, len, sizeof len);
+	if (l != 0xffff)
+		h = vry_fnv(h, val, l);
+	return (h);
+}
+
+static uint64_t
+vry_idx_key(const uint8_t *vary)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; vary[2]; vary += VRY_Len(vary))
+		h = vry_idx_hash(h, vary + 2, vary + 2 + vary[2] + 2,
+		    vbe16dec(vary));
+	return (h);
+}
+
+/* Calculate the key a matching object of this set would have */
+
+static uint64_t
+vry_idx_reqkey(const struct req *req, const uint8_t *vary)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *p, *e;
+	unsigned l;
+	hdr_t hdr;
+
+	for (; vary[2]; vary += VRY_Len(vary)) {
+		CAST_HDR(hdr, vary + 2);
+		l = 0xffff;
+		if (http_GetHdr(req->http, hdr, &p)) {
+			e = strchr(p, '\0');
+			while (e > p && vct_issp(e[-1]))
+				e--;
+			l = e - p;
+			if (l >= 0xffff)	/* cannot match, see VRY_Create() */
+				l = 0xfffe;
+		} else
+			p = NULL;
+		h = vry_idx_hash(h, vary + 2, p, l);
+	}
+	return (h);
+}
+
+static int
+vry_idx_same_names(const uint8_t *v1, const uint8_t *v2)
+{
+
+	for (; v1[2] && v2[2]; v1 += VRY_Len(v1), v2 += VRY_Len(v2))
+		if (memcmp(v1 + 2, v2 + 2, v1[2] + 2))
+			return (0);
+	return (v1[2] == v2[2]);
+}
+
+static void
+vry_idx_resize(struct vry_idx *vi, unsigned bits)
+{
+	struct vry_ihead *ooc, *okey;
+	struct vry_ient *ie;
+	unsigned u, obits;
+
+	obits = vi->bits;
+	ooc = vi->oc_hash;
+	okey = vi->key_hash;
+
+	vi->bits = bits;
+	vi->oc_hash = calloc(1U << bits, sizeof *vi->oc_hash);
+	AN(vi->oc_hash);
+	vi->key_hash = calloc(1U << bits, sizeof *vi->key_hash);
+	AN(vi->key_hash);
+	for (u = 0; u < 1U << bits; u++) {
+		VTAILQ_INIT(&vi->oc_hash[u]);
+		VTAILQ_INIT(&vi->key_hash[u]);
+	}
+	if (ooc == NULL)
+		return;
+
+	AN(okey);
+	for (u = 0; u < 1U << obits; u++) {
+		while ((ie = VTAILQ_FIRST(&ooc[u])) != NULL) {
+			VTAILQ_REMOVE(&ooc[u], ie, oc_list);
+			VTAILQ_INSERT_TAIL(
+			    &vi->oc_hash[vry_idx_ocslot(vi, ie->oc)],
+			    ie, oc_list);
+		}
+		while ((ie = VTAILQ_FIRST(&okey[u])) != NULL) {
+			VTAILQ_REMOVE(&okey[u], ie, key_list);
+			VTAILQ_INSERT_TAIL(
+			    &vi->key_hash[vry_idx_slot(vi, ie->key)],
+			    ie, key_list);
+		}
+	}
+	free(ooc);
+	free(okey);
+}
+
+static struct vry_ient *
+vry_idx_find(const struct vry_idx *vi, const struct objcore *oc)
+{
+	struct vry_ient *ie;
+
+	VTAILQ_FOREACH(ie, &vi->oc_hash[vry_idx_ocslot(vi, oc)], oc_list) {
+		CHECK_OBJ_NOTNULL(ie, VRY_IENT_MAGIC);
+		if (ie->oc == oc)
+			return (ie);
+	}
+	return (NULL);
+}
+
+static void
+vry_idx_unfile(struct vry_idx *vi, struct vry_ient *ie)
+{
+	struct vry_set *vs;
+
+	if (ie->set == NULL) {
+		VTAILQ_REMOVE(&vi->others, ie, key_list);
+		return;
+	}
+	VTAILQ_REMOVE(&vi->key_hash[vry_idx_slot(vi, ie->key)], ie, key_list);
+	TAKE_OBJ_NOTNULL(vs, &ie->set, VRY_SET_MAGIC);
+	assert(vs->refcnt > 0);
+	if (--vs->refcnt > 0)
+		return;
+	VTAILQ_REMOVE(&vi->sets, vs, list);
+	free(vs->vary);
+	FREE_OBJ(vs);
+}
+
+static void
+vry_idx_file(struct worker *wrk, struct vry_idx *vi, struct vry_ient *ie)
+{
+	const uint8_t *vary;
+	struct vry_set *vs;
+	struct objcore *oc;
+	unsigned l;
+
+	oc = ie->oc;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(ie->set);
+	ie->seq = ++vi->seq;
+
+	if ((oc->flags & (OC_F_BUSY | OC_F_DYING | OC_F_FAILED)) ||
+	    oc->stobj->stevedore == NULL ||
+	    !ObjHasAttr(wrk, oc, OA_VARY)) {
+		VTAILQ_INSERT_HEAD(&vi->others, ie, key_list);
+		return;
+	}
+	vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+	AN(vary);
+
+	VTAILQ_FOREACH(vs, &vi->sets, list)
+		if (vry_idx_same_names(vs->vary, vary))
+			break;
+	if (vs == NULL) {
+		ALLOC_OBJ(vs, VRY_SET_MAGIC);
+		AN(vs);
+		l = VRY_Validate(vary);
+		vs->vary = malloc(l);
+		AN(vs->vary);
+		memcpy(vs->vary, vary, l);
+		VTAILQ_INSERT_TAIL(&vi->sets, vs, list);
+	}
+	vs->refcnt++;
+	ie->set = vs;
+	ie->key = vry_idx_key(vary);
+	VTAILQ_INSERT_HEAD(&vi->key_hash[vry_idx_slot(vi, ie->key)],
+	    ie, key_list);
+}
+
+/*
+ * Add or refile an objcore, building the index if the objhead has
+ * reached the vary_index number of objcores.
+ */
+
+void
+VRY_IdxInsert(struct worker *wrk, struct objhead *oh, struct objcore *oc)
+{
+	struct vry_idx *vi;
+	struct vry_ient *ie;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	Lck_AssertHeld(&oh->mtx);
+
+	vi = oh->vary_idx;
+	if (vi == NULL) {
+		if (cache_param->vary_index == 0 ||
+		    oh->n_objcs < cache_param->vary_index)
+			return;
+		ALLOC_OBJ(vi, VRY_IDX_MAGIC);
+		AN(vi);
+		VTAILQ_INIT(&vi->others);
+		VTAILQ_INIT(&vi->sets);
+		vry_idx_resize(vi, VRY_IDX_MINBITS);
+		oh->vary_idx = vi;
+		/* Oldest first, so the head of objcs gets the highest seq */
+		VTAILQ_FOREACH_REVERSE(oc, &oh->objcs, objcorehead, hsh_list)
+			VRY_IdxInsert(wrk, oh, oc);
+		wrk->stats->n_vary_index++;
+		return;
+	}
+	CHECK_OBJ(vi, VRY_IDX_MAGIC);
+
+	ie = vry_idx_find(vi, oc);
+	if (ie != NULL) {
+		vry_idx_unfile(vi, ie);
+	} else {
+		ALLOC_OBJ(ie, VRY_IENT_MAGIC);
+		AN(ie);
+		ie->oc = oc;
+		VTAILQ_INSERT_HEAD(&vi->oc_hash[vry_idx_ocslot(vi, oc)],
+		    ie, oc_list);
+		if (++vi->n > 2U << vi->bits)
+			vry_idx_resize(vi, vi->bits + 1);
+	}
+	vry_idx_file(wrk, vi, ie);
+}
+
+void
+VRY_IdxRemove(struct worker *wrk, struct objhead *oh,
+    const struct objcore *oc)
+{
+	struct vry_idx *vi;
+	struct vry_ient *ie;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	Lck_AssertHeld(&oh->mtx);
+	vi = oh->vary_idx;
+	if (vi == NULL)
+		return;
+	CHECK_OBJ(vi, VRY_IDX_MAGIC);
+
+	ie = vry_idx_find(vi, oc);
+	AN(ie);
+	vry_idx_unfile(vi, ie);
+	VTAILQ_REMOVE(&vi->oc_hash[vry_idx_ocslot(vi, oc)], ie, oc_list);
+	FREE_OBJ(ie);
+	assert(vi->n > 0);
+	if (--vi->n > 0)
+		return;
+
+	assert(VTAILQ_EMPTY(&vi->sets));
+	assert(VTAILQ_EMPTY(&vi->others));
+	for (u = 0; u < 1U << vi->bits; u++) {
+		assert(VTAILQ_EMPTY(&vi->oc_hash[u]));
+		assert(VTAILQ_EMPTY(&vi->key_hash[u]));
+	}
+	free(vi->oc_hash);
+	free(vi->key_hash);
+	FREE_OBJ(vi);
+	oh->vary_idx = NULL;
+	wrk->stats->n_vary_index--;
+}
+
+/*
+ * Collect the objcores which may match the request into ocs, in the
+ * order of oh->objcs. Returns -1 if there are more than n candidates.
+ */
+
+int
+VRY_IdxLookup(const struct req *req, const struct objhead *oh,
+    struct objcore **ocs, unsigned n)
+{
+	const struct vry_idx *vi;
+	const struct vry_ient *ie;
+	const struct vry_set *vs;
+	unsigned seq[VRY_IDX_MAXCAND], i, j, k, s;
+	struct objcore *oc;
+	uint64_t key;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	Lck_AssertHeld(&oh->mtx);
+	vi = oh->vary_idx;
+	CHECK_OBJ_NOTNULL(vi, VRY_IDX_MAGIC);
+	AN(ocs);
+	assert(n <= VRY_IDX_MAXCAND);
+
+	k = 0;
+	VTAILQ_FOREACH(ie, &vi->others, key_list) {
+		if (k == n)
+			return (-1);
+		seq[k] = ie->seq;
+		ocs[k++] = ie->oc;
+	}
+	VTAILQ_FOREACH(vs, &vi->sets, list) {
+		key = vry_idx_reqkey(req, vs->vary);
+		VTAILQ_FOREACH(ie, &vi->key_hash[vry_idx_slot(vi, key)],
+		    key_list) {
+			if (ie->key != key || ie->set != vs)
+				continue;
+			if (k == n)
+				return (-1);
+			seq[k] = ie->seq;
+			ocs[k++] = ie->oc;
+		}
+	}
+
+	/* Newest first, like oh->objcs. Insertion sort, k is small */
+	for (i = 1; i < k; i++) {
+		s = seq[i];
+		oc = ocs[i];
+		for (j = i; j > 0 && seq[j - 1] < s; j--) {
+			seq[j] = seq[j - 1];
+			ocs[j] = ocs[j - 1];
+		}
+		seq[j] = s;
+		ocs[j] = oc;
+	}
+	return ((int)k);
+}
@@ -1048,6 +1048,37 @@ VRT_purge(VRT_CTX, VCL_DURATION ttl, VCL_DURATION grace, VCL_DURATION keep)
 	    ctx->req->t_req, ttl, grace, keep));
 }
 
+VCL_INT
+VRT_purge_tags(VRT_CTX, VCL_STRING tags, VCL_DURATION ttl,
+    VCL_DURATION grace, VCL_DURATION keep)
+{
+	struct worker *wrk;
+	int n;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+	if (ctx->req != NULL)
+		wrk = ctx->req->wrk;
+	else if (ctx->bo != NULL)
+		wrk = ctx->bo->wrk;
+	else
+		wrk = NULL;
+	if (wrk == NULL) {
+		VRT_fail(ctx, "purge by tags needs a client or backend task");
+		return (0);
+	}
+	CHECK_OBJ(wrk, WORKER_MAGIC);
+
+	if (tags == NULL)
+		return (0);
+	n = TAG_Purge(wrk, tags, ctx->now, ttl, grace, keep);
+	if (n < 0) {
+		VRT_fail(ctx, "purge by tags needs the tag_index parameter");
+		return (0);
+	}
+	return (n);
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -254,6 +254,129 @@ pool_getidleworker(struct pool *pp, enum task_prio prio)
 	return (wrk);
 }
 
+/*--------------------------------------------------------------------
+ * Work stealing between pools, see thread_pool_steal
+ *
+ * We probe at most wthread_steal siblings and only ever try their locks,
+ * with our own pool locked, so this cannot deadlock and gives up rather
+ * than wait. Acceptor tasks stay with their pool.
+ */
+
+#define TASK_QUEUE_STEALABLE	TASK_QUEUE_VCA
+
+static struct worker *
+pool_steal_idleworker(struct pool *pp, enum task_prio prio,
+    const struct pool_task *task)
+{
+	struct worker *wrk = NULL;
+	struct pool *pp2;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pp->mtx);
+
+	n = cache_param->wthread_steal;
+	if (n == 0 || prio >= TASK_QUEUE_STEALABLE)
+		return (NULL);
+	if (Lck_Trylock(&pool_mtx))
+		return (NULL);
+	for (pp2 = pool_next(pp); pp2 != NULL && pp2 != pp && n > 0;
+	    pp2 = pool_next(pp2), n--) {
+		/* racy peek, we do not want to bother pools with no idlers */
+		if (pp2->nidle == 0 || Lck_Trylock(&pp2->mtx))
+			continue;
+		wrk = pool_getidleworker(pp2, prio);
+		if (wrk != NULL) {
+			AZ(wrk->task->func);
+			wrk->task->func = task->func;
+			wrk->task->priv = task->priv;
+			pp2->stats->tasks_stolen++;
+		}
+		Lck_Unlock(&pp2->mtx);
+		if (wrk != NULL)
+			break;
+	}
+	Lck_Unlock(&pool_mtx);
+	return (wrk);
+}
+
+/*--------------------------------------------------------------------
+ * Account the time a task spent on queue prio of pp. The histogram in
+ * pp->qwait is only kept for the latency driven herder.
+ */
+
+static void
+pool_qwait(struct pool *pp, unsigned prio, const struct pool_task *tp)
+{
+	vtim_dur d, us;
+	unsigned b;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pp->mtx);
+	assert(prio < TASK_QUEUE_RESERVE);
+	AN(tp);
+
+	d = VTIM_mono() - tp->queued;
+	if (d < 1e-3)
+		pp->stats->queue_wait_1ms++;
+	else if (d < 1e-2)
+		pp->stats->queue_wait_10ms++;
+	else if (d < 1e-1)
+		pp->stats->queue_wait_100ms++;
+	else if (d < 1.)
+		pp->stats->queue_wait_1s++;
+	else
+		pp->stats->queue_wait_more++;
+
+	if (cache_param->wthread_queue_target == 0.)
+		return;
+	for (b = 0, us = 1e-6; b < POOL_QWAIT_NBUCKET - 1 && d >= us; b++)
+		us *= 2;
+	pp->qwait[prio][b]++;
+}
+
+static struct pool_task *
+pool_steal_task(struct pool *pp, unsigned nprio)
+{
+	struct pool_task *tp = NULL;
+	struct pool *pp2;
+	unsigned i, n;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pp->mtx);
+
+	n = cache_param->wthread_steal;
+	if (n == 0 || nprio == 0)
+		return (NULL);
+	if (nprio > TASK_QUEUE_STEALABLE)
+		nprio = TASK_QUEUE_STEALABLE;
+	if (Lck_Trylock(&pool_mtx))
+		return (NULL);
+	for (pp2 = pool_next(pp); pp2 != NULL && pp2 != pp && n > 0;
+	    pp2 = pool_next(pp2), n--) {
+		/* racy peek, as above */
+		if (pp2->lqueue == 0 || Lck_Trylock(&pp2->mtx))
+			continue;
+		for (i = 0; i < nprio; i++) {
+			tp = VTAILQ_FIRST(&pp2->queues[i]);
+			if (tp != NULL) {
+				pp2->lqueue--;
+				pp2->ndequeued--;
+				VTAILQ_REMOVE(&pp2->queues[i], tp, list);
+				pool_qwait(pp2, i, tp);
+				break;
+			}
+		}
+		Lck_Unlock(&pp2->mtx);
+		if (tp != NULL)
+			break;
+	}
+	Lck_Unlock(&pool_mtx);
+	if (tp != NULL)
+		pp->stats->tasks_stolen++;
+	return (tp);
+}
+
 /*--------------------------------------------------------------------
  * Special scheduling:  If no thread can be found, the current thread
  * will be prepared for rescheduling instead.
@@ -335,6 +458,16 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 		return (0);
 	}
 
+	/* Rather than queue, try an idle thread of a sibling pool */
+
+	wrk = pool_steal_idleworker(pp, prio, task);
+	if (wrk != NULL) {
+		Lck_Unlock(&pp->mtx);
+		// see signaling_note at the top for explanation
+		PTOK(pthread_cond_signal(&wrk->cond));
+		return (0);
+	}
+
 	/* Vital work is always queued. Only priority classes that can
 	 * fit under the reserve capacity are eligible to queuing.
 	 */
@@ -345,6 +478,7 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 	    cache_param->wthread_queue_limit) {
 		pp->stats->sess_queued++;
 		pp->lqueue++;
+		task->queued = VTIM_mono();
 		VTAILQ_INSERT_TAIL(&pp->queues[prio], task, list);
 		PTOK(pthread_cond_signal(&pp->herder_cond));
 	} else {
@@ -407,10 +541,14 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 				pp->lqueue--;
 				pp->ndequeued--;
 				VTAILQ_REMOVE(&pp->queues[i], tp, list);
+				pool_qwait(pp, i, tp);
 				break;
 			}
 		}
 
+		if (tp == NULL)
+			tp = pool_steal_task(pp, i);
+
 		if (wrk_addstat(wrk, tp, 1)) {
 			wrk->stats->summs++;
 			AN(tp);
@@ -574,6 +712,72 @@ pool_breed(struct pool *qp)
 	PTOK(pthread_attr_destroy(&tp_attr));
 }
 
+/*--------------------------------------------------------------------
+ * Latency driven herding, see thread_pool_queue_target
+ *
+ * Estimate the 99th percentile of the queue wait of each priority from
+ * the histogram of the current window, also counting the time the oldest
+ * queued task has been waiting already. If it exceeds the target, return
+ * the number of threads to breed in one go: enough for the current queue,
+ * up to thread_pool_burst. Otherwise, *delay is lowered to when the
+ * oldest task would reach the target.
+ */
+
+static unsigned
+pool_herd_latency(struct pool *pp, vtim_dur *p99p, vtim_dur *delay)
+{
+	const struct pool_task *tp;
+	vtim_dur target, p99 = 0., w;
+	vtim_mono now;
+	unsigned i, b, n, sum;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pp->mtx);
+	AN(p99p);
+	AN(delay);
+
+	target = cache_param->wthread_queue_target;
+	assert(target > 0.);
+	now = VTIM_mono();
+
+	for (i = 0; i < TASK_QUEUE_RESERVE; i++) {
+		tp = VTAILQ_FIRST(&pp->queues[i]);
+		if (tp != NULL) {
+			w = now - tp->queued;
+			p99 = vmax(p99, w);
+			if (w < target)
+				*delay = vmin(*delay, target - w);
+		}
+		for (n = 0, b = 0; b < POOL_QWAIT_NBUCKET; b++)
+			n += pp->qwait[i][b];
+		if (n == 0)
+			continue;
+		n -= n / 100;
+		for (sum = 0, b = 0; b < POOL_QWAIT_NBUCKET - 1; b++) {
+			sum += pp->qwait[i][b];
+			if (sum >= n)
+				break;
+		}
+		/* upper bound of bucket b */
+		p99 = vmax(p99, ldexp(1e-6, (int)b));
+	}
+
+	*p99p = p99;
+	if (p99 <= target) {
+		if (now - pp->qwait_t0 > vmax(1., 10 * target)) {
+			memset(pp->qwait, 0, sizeof pp->qwait);
+			pp->qwait_t0 = now;
+		}
+		return (0);
+	}
+
+	/* React once per spike */
+	memset(pp->qwait, 0, sizeof pp->qwait);
+	pp->qwait_t0 = now;
+	n = vmax(pp->lqueue, 1U);
+	return (vmin(n, cache_param->wthread_burst));
+}
+
 /*--------------------------------------------------------------------
  * Herd a single pool
  *
@@ -586,6 +790,10 @@ pool_breed(struct pool *qp)
  *
  * Idle threads are destroyed at a rate determined by wthread_destroy_delay
  *
+ * With thread_pool_queue_target, we do not breed for every queued task,
+ * but when tasks wait for too long, see pool_herd_latency(). Idle threads
+ * are then only destroyed while the queue wait is well below the target.
+ *
  * XXX: probably need a lot more work.
  *
  */
@@ -598,7 +806,8 @@ pool_herder(void *priv)
 	double t_idle;
 	struct worker *wrk;
 	double delay;
-	unsigned wthread_min;
+	vtim_dur qtarget, qdelay, p99;
+	unsigned wthread_min, n;
 	uintmax_t dq = (1ULL << 31);
 	vtim_mono dqt = 0;
 	int r = 0;
@@ -641,8 +850,30 @@ pool_herder(void *priv)
 			wthread_min = 0;
 
 		/* Make more threads if needed and allowed */
-		if (pp->nthr < wthread_min ||
-		    (pp->lqueue > 0 && pp->nthr < cache_param->wthread_max)) {
+		if (pp->nthr < wthread_min) {
+			pool_breed(pp);
+			continue;
+		}
+
+		qtarget = cache_param->wthread_queue_target;
+		if (pp->die)
+			qtarget = 0.;
+		qdelay = qtarget;
+		p99 = 0.;
+
+		if (qtarget > 0.) {
+			Lck_Lock(&pp->mtx);
+			n = pool_herd_latency(pp, &p99, &qdelay);
+			Lck_Unlock(&pp->mtx);
+			if (n > 0 && pp->nthr < cache_param->wthread_max) {
+				do
+					pool_breed(pp);
+				while (--n > 0 &&
+				    pp->nthr < cache_param->wthread_max);
+				continue;
+			}
+		} else if (pp->lqueue > 0 &&
+		    pp->nthr < cache_param->wthread_max) {
 			pool_breed(pp);
 			continue;
 		}
@@ -650,7 +881,8 @@ pool_herder(void *priv)
 		delay = cache_param->wthread_timeout;
 		assert(pp->nthr >= wthread_min);
 
-		if (pp->nthr > wthread_min) {
+		if (pp->nthr > wthread_min && (qtarget == 0. ||
+		    p99 * 2 < qtarget || pp->nthr > cache_param->wthread_max)) {
 
 			t_idle = VTIM_real() - cache_param->wthread_timeout;
 
@@ -709,6 +941,10 @@ pool_herder(void *priv)
 				VSC_C_main->threads_limited++;
 			r = Lck_CondWaitTimeout(
 			    &pp->herder_cond, &pp->mtx, 1.0);
+		} else if (qtarget > 0.) {
+			/* Queued, but not for too long (yet) */
+			r = Lck_CondWaitTimeout(
+			    &pp->herder_cond, &pp->mtx, vmax(qdelay, 1e-3));
 		}
 		Lck_Unlock(&pp->mtx);
 	}
@@ -46,6 +46,9 @@ struct listen_sock {
 	VTAILQ_ENTRY(listen_sock)	arglist;
 	VTAILQ_ENTRY(listen_sock)	vcalist;
 	int				sock;
+	/* with reuseport=, all sockets, the first being sock */
+	int				*socks;
+	unsigned			nsocks;
 	int				uds;
 	char				*endpoint;
 	const char			*name;
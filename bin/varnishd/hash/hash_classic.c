@@ -29,10 +29,17 @@
  * SUCH DAMAGE.
  *
  * A classic bucketed hash
+ *
+ * When the average chain gets longer than HCL_LOAD_MAX, the hcl-resizer
+ * thread allocates a table with twice the buckets and moves the chains
+ * over one bucket at a time. Lookups which find a bucket already moved
+ * continue in the new table, so no lookup ever waits for more than one
+ * bucket to be moved. Old tables are freed after critbit_cooloff.
  */
 
 #include "config.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -41,6 +48,9 @@
 #include "common/heritage.h"
 
 #include "hash/hash_slinger.h"
+#include "vtim.h"
+
+#define HCL_LOAD_MAX		4
 
 static struct VSC_lck *lck_hcl;
 
@@ -49,12 +59,29 @@ static struct VSC_lck *lck_hcl;
 struct hcl_hd {
 	unsigned		magic;
 #define HCL_HEAD_MAGIC		0x0f327016
+	unsigned		migrated;
 	VTAILQ_HEAD(, objhead)	head;
 	struct lock		mtx;
 };
 
+struct hcl_tbl {
+	unsigned		magic;
+#define HCL_TBL_MAGIC		0x4d6e0b39
+	unsigned		nhash;
+	struct hcl_hd		*head;
+	struct hcl_tbl		*next;
+	vtim_real		t_retired;
+	VTAILQ_ENTRY(hcl_tbl)	list;
+};
+
 static unsigned			hcl_nhash = 16383;
-static struct hcl_hd		*hcl_head;
+static struct hcl_tbl * volatile hcl_tbl;
+static uint64_t			hcl_nobj;
+
+static struct lock		hcl_mtx;
+static pthread_cond_t		hcl_cond;
+static unsigned			hcl_grow;
+static VTAILQ_HEAD(, hcl_tbl)	hcl_retired = VTAILQ_HEAD_INITIALIZER(hcl_retired);
 
 /*--------------------------------------------------------------------
  * The ->init method allows the management process to pass arguments
@@ -86,6 +113,155 @@ hcl_init(int ac, char * const *av)
 	fprintf(stderr, "Classic hash: %u buckets\n", hcl_nhash);
 }
 
+/*--------------------------------------------------------------------*/
+
+static struct hcl_tbl *
+hcl_tbl_new(unsigned nhash)
+{
+	struct hcl_tbl *t;
+	unsigned u;
+
+	ALLOC_OBJ(t, HCL_TBL_MAGIC);
+	XXXAN(t);
+	t->nhash = nhash;
+	t->head = calloc(nhash, sizeof *t->head);
+	XXXAN(t->head);
+
+	for (u = 0; u < nhash; u++) {
+		VTAILQ_INIT(&t->head[u].head);
+		Lck_New(&t->head[u].mtx, lck_hcl);
+		t->head[u].magic = HCL_HEAD_MAGIC;
+	}
+	return (t);
+}
+
+static void
+hcl_tbl_free(struct hcl_tbl **tp)
+{
+	struct hcl_tbl *t;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(t, tp, HCL_TBL_MAGIC);
+	for (u = 0; u < t->nhash; u++) {
+		assert(t->head[u].migrated);
+		assert(VTAILQ_EMPTY(&t->head[u].head));
+		Lck_Delete(&t->head[u].mtx);
+	}
+	free(t->head);
+	FREE_OBJ(t);
+}
+
+static struct hcl_hd *
+hcl_bucket(const struct hcl_tbl *t, const void *digest)
+{
+	unsigned hdigest;
+
+	CHECK_OBJ_NOTNULL(t, HCL_TBL_MAGIC);
+	assert(DIGEST_LEN >= sizeof hdigest);
+	memcpy(&hdigest, digest, sizeof hdigest);
+	return (&t->head[hdigest % t->nhash]);
+}
+
+/*--------------------------------------------------------------------
+ * Move all objheads of an old bucket to the new table
+ */
+
+static void
+hcl_migrate(struct hcl_hd *hp, const struct hcl_tbl *n)
+{
+	struct objhead *oh, *oh2;
+	struct hcl_hd *hp2;
+
+	Lck_Lock(&hp->mtx);
+	AZ(hp->migrated);
+	while ((oh = VTAILQ_FIRST(&hp->head)) != NULL) {
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		VTAILQ_REMOVE(&hp->head, oh, hoh_list);
+		hp2 = hcl_bucket(n, oh->digest);
+		Lck_Lock(&hp2->mtx);
+		VTAILQ_FOREACH(oh2, &hp2->head, hoh_list) {
+			if (memcmp(oh2->digest, oh->digest,
+			    sizeof oh->digest) > 0)
+				break;
+		}
+		if (oh2 != NULL)
+			VTAILQ_INSERT_BEFORE(oh2, oh, hoh_list);
+		else
+			VTAILQ_INSERT_TAIL(&hp2->head, oh, hoh_list);
+		oh->hoh_head = hp2;
+		Lck_Unlock(&hp2->mtx);
+	}
+	hp->migrated = 1;
+	Lck_Unlock(&hp->mtx);
+}
+
+static int
+hcl_overloaded(const struct hcl_tbl *t)
+{
+
+	CHECK_OBJ_NOTNULL(t, HCL_TBL_MAGIC);
+	return (t->nhash < UINT_MAX / 2 &&
+	    __atomic_load_n(&hcl_nobj, __ATOMIC_RELAXED) >
+	    (uint64_t)t->nhash * HCL_LOAD_MAX);
+}
+
+static void
+hcl_kick(void)
+{
+
+	Lck_Lock(&hcl_mtx);
+	if (!hcl_grow) {
+		hcl_grow = 1;
+		PTOK(pthread_cond_signal(&hcl_cond));
+	}
+	Lck_Unlock(&hcl_mtx);
+}
+
+static void * v_matchproto_(bgthread_t)
+hcl_resizer(struct worker *wrk, void *priv)
+{
+	struct hcl_tbl *t, *n;
+	vtim_real now;
+	unsigned u;
+
+	(void)wrk;
+	(void)priv;
+	Lck_Lock(&hcl_mtx);
+	while (1) {
+		t = hcl_tbl;
+		CHECK_OBJ_NOTNULL(t, HCL_TBL_MAGIC);
+		VSC_C_main->hcl_buckets = t->nhash;
+		VSC_C_main->hcl_load = __atomic_load_n(&hcl_nobj,
+		    __ATOMIC_RELAXED) * 100 / t->nhash;
+
+		now = VTIM_real();
+		while ((n = VTAILQ_FIRST(&hcl_retired)) != NULL &&
+		    now - n->t_retired > cache_param->critbit_cooloff) {
+			VTAILQ_REMOVE(&hcl_retired, n, list);
+			hcl_tbl_free(&n);
+		}
+
+		if (!hcl_grow) {
+			(void)Lck_CondWaitTimeout(&hcl_cond, &hcl_mtx, 1.0);
+			continue;
+		}
+		Lck_Unlock(&hcl_mtx);
+
+		n = hcl_tbl_new(t->nhash * 2 + 1);
+		t->next = n;
+		for (u = 0; u < t->nhash; u++)
+			hcl_migrate(&t->head[u], n);
+		hcl_tbl = n;
+		VSC_C_main->hcl_resize++;
+
+		Lck_Lock(&hcl_mtx);
+		t->t_retired = VTIM_real();
+		VTAILQ_INSERT_TAIL(&hcl_retired, t, list);
+		hcl_grow = hcl_overloaded(n);
+	}
+	NEEDLESS(return (NULL));
+}
+
 /*--------------------------------------------------------------------
  * The ->start method is called during cache process start and allows
  * initialization to happen before the first lookup.
@@ -94,17 +270,13 @@ hcl_init(int ac, char * const *av)
 static void v_matchproto_(hash_start_f)
 hcl_start(void)
 {
-	unsigned u;
+	pthread_t tp;
 
 	lck_hcl = Lck_CreateClass(NULL, "hcl");
-	hcl_head = calloc(hcl_nhash, sizeof *hcl_head);
-	XXXAN(hcl_head);
-
-	for (u = 0; u < hcl_nhash; u++) {
-		VTAILQ_INIT(&hcl_head[u].head);
-		Lck_New(&hcl_head[u].mtx, lck_hcl);
-		hcl_head[u].magic = HCL_HEAD_MAGIC;
-	}
+	Lck_New(&hcl_mtx, lck_hcl);
+	PTOK(pthread_cond_init(&hcl_cond, NULL));
+	hcl_tbl = hcl_tbl_new(hcl_nhash);
+	WRK_BgThread(&tp, "hcl-resizer", hcl_resizer, NULL);
 }
 
 /*--------------------------------------------------------------------
@@ -114,14 +286,16 @@ hcl_start(void)
  * A reference to the returned object is held.
  * We use a two-pass algorithm to handle inserts as they are quite
  * rare and collisions even rarer.
+ * While the table is being resized, buckets which have already been
+ * moved send us on to the new table.
  */
 
 static struct objhead * v_matchproto_(hash_lookup_f)
 hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
+	struct hcl_tbl *t;
 	struct hcl_hd *hp;
-	unsigned u1, hdigest;
 	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -129,14 +303,20 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	if (noh != NULL)
 		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
 
-	assert(sizeof oh->digest >= sizeof hdigest);
-	memcpy(&hdigest, digest, sizeof hdigest);
-	u1 = hdigest % hcl_nhash;
-	hp = &hcl_head[u1];
-
+	t = hcl_tbl;
+	hp = hcl_bucket(t, digest);
 	Lck_Lock(&hp->mtx);
+	while (hp->migrated) {
+		Lck_Unlock(&hp->mtx);
+		t = t->next;
+		hp = hcl_bucket(t, digest);
+		Lck_Lock(&hp->mtx);
+	}
+
+	wrk->stats->hcl_lookup++;
 	VTAILQ_FOREACH(oh, &hp->head, hoh_list) {
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		wrk->stats->hcl_walk++;
 		i = memcmp(oh->digest, digest, sizeof oh->digest);
 		if (i < 0)
 			continue;
@@ -165,6 +345,10 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	oh->hoh_head = hp;
 
 	Lck_Unlock(&hp->mtx);
+	if (__atomic_add_fetch(&hcl_nobj, 1, __ATOMIC_RELAXED) >
+	    (uint64_t)t->nhash * HCL_LOAD_MAX && !hcl_grow &&
+	    hcl_overloaded(t))
+		hcl_kick();
 	Lck_Lock(&oh->mtx);
 	return (oh);
 }
@@ -183,11 +367,18 @@ hcl_deref(struct worker *wrk, struct objhead *oh)
 	Lck_AssertHeld(&oh->mtx);
 	Lck_Unlock(&oh->mtx);
 
-	CAST_OBJ_NOTNULL(hp, oh->hoh_head, HCL_HEAD_MAGIC);
+	/* The objhead may be moved to a new table until we hold its bucket */
+	while (1) {
+		CAST_OBJ_NOTNULL(hp, oh->hoh_head, HCL_HEAD_MAGIC);
+		Lck_Lock(&hp->mtx);
+		if (oh->hoh_head == hp)
+			break;
+		Lck_Unlock(&hp->mtx);
+	}
 	assert(oh->refcnt > 0);
-	Lck_Lock(&hp->mtx);
 	if (--oh->refcnt == 0) {
 		VTAILQ_REMOVE(&hp->head, oh, hoh_list);
+		(void)__atomic_sub_fetch(&hcl_nobj, 1, __ATOMIC_RELAXED);
 		ret = 0;
 	} else
 		ret = 1;
@@ -61,3 +61,4 @@ void HSH_Cleanup(const struct worker *);
 extern const struct hash_slinger hsl_slinger;
 extern const struct hash_slinger hcl_slinger;
 extern const struct hash_slinger hcb_slinger;
+extern const struct hash_slinger hsw_slinger;
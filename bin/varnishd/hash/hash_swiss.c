@@ -0,0 +1,518 @@
+/*-
+ * Copyright 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * An open addressing hash table in the style of a "Swiss table": Slots
+ * are arranged in groups of 16, and each slot has a control byte holding
+ * seven bits of the digest, so one group can be probed with a single
+ * SSE2 comparison.
+ *
+ * As with critbit, lookups are first tried without holding a lock, and
+ * removed objheads are only freed after critbit_cooloff.  Modifications
+ * happen under hsw_mtx.  When the table gets too full, a new table is
+ * allocated and the entries are migrated in batches by the cleaner
+ * thread, while lookups check both tables.  The old table is freed after
+ * the cooloff, too.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+#include "vend.h"
+#include "vmb.h"
+#include "vtim.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#define HSW_GROUP		16
+#define HSW_EMPTY		0x80
+#define HSW_DELETED		0xfe
+#define HSW_MIGRATE		4096	/* slots per migration step */
+
+struct hsw_tbl {
+	unsigned		magic;
+#define HSW_TBL_MAGIC		0x5a3f0e71
+	unsigned		gmask;
+	unsigned		nslot;
+	unsigned		used;
+	unsigned		tomb;
+	uint8_t			*ctrl;
+	struct objhead		**slot;
+	VSTAILQ_ENTRY(hsw_tbl)	list;
+};
+
+static struct VSC_lck		*lck_hsw;
+static struct lock		hsw_mtx;
+static pthread_cond_t		hsw_cond;
+
+static unsigned			hsw_nslot = 1U << 16;
+static struct hsw_tbl * volatile hsw_cur;
+static struct hsw_tbl * volatile hsw_old;
+static unsigned			hsw_mig_pos;
+
+static VSTAILQ_HEAD(, hsw_tbl)	cool_t = VSTAILQ_HEAD_INITIALIZER(cool_t);
+static VSTAILQ_HEAD(, hsw_tbl)	dead_t = VSTAILQ_HEAD_INITIALIZER(dead_t);
+static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
+static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+
+/*--------------------------------------------------------------------
+ * The first 64 bits of the digest select the group, the top bit of the
+ * control byte is reserved for empty and deleted slots.
+ */
+
+static inline unsigned
+hsw_h1(const struct hsw_tbl *t, const uint8_t *digest)
+{
+
+	return ((unsigned)vbe64dec(digest) & t->gmask);
+}
+
+static inline uint8_t
+hsw_h2(const uint8_t *digest)
+{
+
+	return (digest[8] & 0x7f);
+}
+
+/* Bitmap of the slots in a group whose control byte is b */
+
+static inline unsigned
+hsw_match(const uint8_t *ctrl, uint8_t b)
+{
+#if defined(__SSE2__)
+	__m128i g;
+
+	g = _mm_load_si128((const void *)ctrl);
+	return ((unsigned)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(g, _mm_set1_epi8((char)b))));
+#else
+	unsigned u, m = 0;
+
+	for (u = 0; u < HSW_GROUP; u++)
+		if (ctrl[u] == b)
+			m |= 1U << u;
+	return (m);
+#endif
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct hsw_tbl *
+hsw_tbl_new(unsigned nslot)
+{
+	struct hsw_tbl *t;
+
+	assert(nslot >= HSW_GROUP);
+	assert(!(nslot & (nslot - 1)));
+	ALLOC_OBJ(t, HSW_TBL_MAGIC);
+	AN(t);
+	t->nslot = nslot;
+	t->gmask = nslot / HSW_GROUP - 1;
+	AZ(posix_memalign((void **)&t->ctrl, HSW_GROUP, nslot));
+	memset(t->ctrl, HSW_EMPTY, nslot);
+	t->slot = calloc(nslot, sizeof *t->slot);
+	AN(t->slot);
+	return (t);
+}
+
+static void
+hsw_tbl_free(struct hsw_tbl **tp)
+{
+	struct hsw_tbl *t;
+
+	TAKE_OBJ_NOTNULL(t, tp, HSW_TBL_MAGIC);
+	free(t->ctrl);
+	free(t->slot);
+	FREE_OBJ(t);
+}
+
+/*--------------------------------------------------------------------
+ * Find a digest in a table. This is called both with and without
+ * hsw_mtx held: Writers store the slot before the control byte, so a
+ * matching control byte either comes with its objhead or a NULL slot
+ * of a concurrent delete.
+ */
+
+static struct objhead *
+hsw_find(const struct hsw_tbl *t, const uint8_t *digest, unsigned *sp)
+{
+	struct objhead *oh;
+	const uint8_t *ctrl;
+	unsigned g, i, m, s;
+	uint8_t h2;
+
+	CHECK_OBJ_NOTNULL(t, HSW_TBL_MAGIC);
+	h2 = hsw_h2(digest);
+	g = hsw_h1(t, digest);
+	for (i = 0; i <= t->gmask; i++) {
+		ctrl = t->ctrl + (size_t)g * HSW_GROUP;
+		m = hsw_match(ctrl, h2);
+		if (m != 0)
+			VRMB();
+		while (m != 0) {
+			s = g * HSW_GROUP + ffs((int)m) - 1;
+			m &= m - 1;
+			oh = t->slot[s];
+			if (oh == NULL ||
+			    memcmp(oh->digest, digest, sizeof oh->digest))
+				continue;
+			if (sp != NULL)
+				*sp = s;
+			return (oh);
+		}
+		if (hsw_match(ctrl, HSW_EMPTY) != 0)
+			return (NULL);
+		g = (g + i + 1) & t->gmask;
+	}
+	return (NULL);
+}
+
+static struct objhead *
+hsw_find_any(const uint8_t *digest)
+{
+	struct hsw_tbl *t, *o;
+	struct objhead *oh;
+
+	t = hsw_cur;
+	VRMB();
+	o = hsw_old;
+	oh = hsw_find(t, digest, NULL);
+	if (oh == NULL && o != NULL)
+		oh = hsw_find(o, digest, NULL);
+	return (oh);
+}
+
+/*--------------------------------------------------------------------
+ * The functions below must be called with hsw_mtx held.
+ */
+
+static void
+hsw_put(struct hsw_tbl *t, struct objhead *oh)
+{
+	uint8_t *ctrl;
+	unsigned g, i, m, s;
+
+	CHECK_OBJ_NOTNULL(t, HSW_TBL_MAGIC);
+	g = hsw_h1(t, oh->digest);
+	for (i = 0; i <= t->gmask; i++) {
+		ctrl = t->ctrl + (size_t)g * HSW_GROUP;
+		m = hsw_match(ctrl, HSW_EMPTY) | hsw_match(ctrl, HSW_DELETED);
+		if (m != 0) {
+			s = g * HSW_GROUP + ffs((int)m) - 1;
+			if (t->ctrl[s] == HSW_DELETED) {
+				assert(t->tomb > 0);
+				t->tomb--;
+			}
+			AZ(t->slot[s]);
+			t->slot[s] = oh;
+			VWMB();
+			t->ctrl[s] = hsw_h2(oh->digest);
+			t->used++;
+			return;
+		}
+		g = (g + i + 1) & t->gmask;
+	}
+	WRONG("hsw table full");
+}
+
+static void
+hsw_del(struct hsw_tbl *t, unsigned s)
+{
+
+	CHECK_OBJ_NOTNULL(t, HSW_TBL_MAGIC);
+	assert(s < t->nslot);
+	assert(t->ctrl[s] < HSW_EMPTY);
+	t->ctrl[s] = HSW_DELETED;
+	t->slot[s] = NULL;
+	assert(t->used > 0);
+	t->used--;
+	t->tomb++;
+}
+
+static void
+hsw_migrate(unsigned n)
+{
+	struct hsw_tbl *o;
+	unsigned s;
+
+	Lck_AssertHeld(&hsw_mtx);
+	o = hsw_old;
+	CHECK_OBJ_NOTNULL(o, HSW_TBL_MAGIC);
+	for (; n > 0 && hsw_mig_pos < o->nslot; n--, hsw_mig_pos++) {
+		s = hsw_mig_pos;
+		if (o->ctrl[s] >= HSW_EMPTY)
+			continue;
+		/* Insert first, so concurrent lookups always find it */
+		hsw_put(hsw_cur, o->slot[s]);
+		hsw_del(o, s);
+	}
+	if (hsw_mig_pos < o->nslot)
+		return;
+	AZ(o->used);
+	hsw_old = NULL;
+	VSTAILQ_INSERT_TAIL(&cool_t, o, list);
+}
+
+/*
+ * Resize when used and deleted slots exceed 7/8 of the table. If less
+ * than half the slots are in use, rebuilding at the same size is enough
+ * to get rid of the tombstones.
+ */
+
+static void
+hsw_check_load(void)
+{
+	struct hsw_tbl *t, *n;
+	unsigned nslot;
+
+	Lck_AssertHeld(&hsw_mtx);
+	t = hsw_cur;
+	CHECK_OBJ_NOTNULL(t, HSW_TBL_MAGIC);
+	if ((uint64_t)(t->used + t->tomb) * 8 <= (uint64_t)t->nslot * 7)
+		return;
+
+	/* Finish a running migration, we only keep two tables */
+	if (hsw_old != NULL)
+		hsw_migrate(UINT_MAX);
+	AZ(hsw_old);
+
+	nslot = t->nslot;
+	if (t->used * 2 >= nslot) {
+		assert(nslot < (1U << 31));
+		nslot *= 2;
+	}
+	n = hsw_tbl_new(nslot);
+	hsw_mig_pos = 0;
+	hsw_old = t;
+	VWMB();
+	hsw_cur = n;
+	VSC_C_main->hsw_resize++;
+	PTOK(pthread_cond_signal(&hsw_cond));
+}
+
+static void
+hsw_delete(struct objhead *oh)
+{
+	struct objhead *oh2;
+	unsigned s;
+
+	Lck_AssertHeld(&hsw_mtx);
+	oh2 = hsw_find(hsw_cur, oh->digest, &s);
+	if (oh2 != NULL) {
+		assert(oh2 == oh);
+		hsw_del(hsw_cur, s);
+		return;
+	}
+	AN(hsw_old);
+	oh2 = hsw_find(hsw_old, oh->digest, &s);
+	assert(oh2 == oh);
+	hsw_del(hsw_old, s);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void * v_matchproto_(bgthread_t)
+hsw_cleaner(struct worker *wrk, void *priv)
+{
+	VSTAILQ_HEAD(, hsw_tbl) tbls = VSTAILQ_HEAD_INITIALIZER(tbls);
+	VTAILQ_HEAD(, objhead) ohs = VTAILQ_HEAD_INITIALIZER(ohs);
+	struct hsw_tbl *t, *t2;
+	struct objhead *oh, *oh2;
+	vtim_real t_cool, now;
+
+	(void)priv;
+	t_cool = VTIM_real();
+	while (1) {
+		Lck_Lock(&hsw_mtx);
+		if (hsw_old != NULL) {
+			hsw_migrate(HSW_MIGRATE);
+			Lck_Unlock(&hsw_mtx);
+			continue;
+		}
+		now = VTIM_real();
+		if (now - t_cool < cache_param->critbit_cooloff) {
+			(void)Lck_CondWaitTimeout(&hsw_cond, &hsw_mtx, 1.0);
+			Lck_Unlock(&hsw_mtx);
+			continue;
+		}
+		t_cool = now;
+		VSTAILQ_CONCAT(&tbls, &dead_t);
+		VTAILQ_CONCAT(&ohs, &dead_h, hoh_list);
+		VSTAILQ_CONCAT(&dead_t, &cool_t);
+		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
+		Lck_Unlock(&hsw_mtx);
+
+		VSTAILQ_FOREACH_SAFE(t, &tbls, list, t2) {
+			VSTAILQ_REMOVE_HEAD(&tbls, list);
+			hsw_tbl_free(&t);
+		}
+		VTAILQ_FOREACH_SAFE(oh, &ohs, hoh_list, oh2) {
+			CHECK_OBJ(oh, OBJHEAD_MAGIC);
+			VTAILQ_REMOVE(&ohs, oh, hoh_list);
+			HSH_DeleteObjHead(wrk, oh);
+		}
+		Pool_Sumstat(wrk);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * The ->init method allows the management process to pass arguments
+ */
+
+static void v_matchproto_(hash_init_f)
+hsw_init(int ac, char * const *av)
+{
+	int i;
+	unsigned u, n;
+
+	if (ac == 0)
+		return;
+	if (ac > 1)
+		ARGV_ERR("(-hswiss) too many arguments\n");
+	i = sscanf(av[0], "%u", &u);
+	if (i <= 0 || u == 0)
+		return;
+	if (u > (1U << 30))
+		ARGV_ERR("(-hswiss) too many slots\n");
+	for (n = HSW_GROUP; n < u; n <<= 1)
+		continue;
+	hsw_nslot = n;
+	fprintf(stderr, "Swiss hash: %u initial slots\n", hsw_nslot);
+}
+
+static void v_matchproto_(hash_start_f)
+hsw_start(void)
+{
+	pthread_t tp;
+
+	lck_hsw = Lck_CreateClass(NULL, "hsw");
+	Lck_New(&hsw_mtx, lck_hsw);
+	PTOK(pthread_cond_init(&hsw_cond, NULL));
+	hsw_cur = hsw_tbl_new(hsw_nslot);
+	WRK_BgThread(&tp, "hsw-cleaner", hsw_cleaner, NULL);
+}
+
+static int v_matchproto_(hash_deref_f)
+hsw_deref(struct worker *wrk, struct objhead *oh)
+{
+	int r;
+
+	(void)wrk;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	Lck_AssertHeld(&oh->mtx);
+	assert(oh->refcnt > 0);
+	r = --oh->refcnt;
+	if (r == 0) {
+		Lck_Lock(&hsw_mtx);
+		hsw_delete(oh);
+		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
+		Lck_Unlock(&hsw_mtx);
+	}
+	Lck_Unlock(&oh->mtx);
+	return (r);
+}
+
+static struct objhead * v_matchproto_(hash_lookup_f)
+hsw_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
+{
+	struct objhead *oh;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	if (noh != NULL) {
+		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
+		assert((*noh)->refcnt == 1);
+	}
+
+	/* First try in read-only mode without holding a lock */
+
+	wrk->stats->hsw_nolock++;
+	oh = hsw_find_any(digest);
+	if (oh != NULL) {
+		Lck_Lock(&oh->mtx);
+		/*
+		 * A refcount of zero indicates that the objhead is being
+		 * removed, so try again with the lock held.
+		 */
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			return (oh);
+		}
+		Lck_Unlock(&oh->mtx);
+	}
+
+	while (1) {
+		Lck_Lock(&hsw_mtx);
+		VSC_C_main->hsw_lock++;
+		oh = hsw_find_any(digest);
+		if (oh == NULL && noh != NULL) {
+			TAKE_OBJ_NOTNULL(oh, noh, OBJHEAD_MAGIC);
+			memcpy(oh->digest, digest, sizeof oh->digest);
+			hsw_put(hsw_cur, oh);
+			VSC_C_main->hsw_insert++;
+			if (hsw_old != NULL)
+				hsw_migrate(HSW_GROUP);
+			hsw_check_load();
+			Lck_Unlock(&hsw_mtx);
+			Lck_Lock(&oh->mtx);
+			assert(oh->refcnt > 0);
+			return (oh);
+		}
+		Lck_Unlock(&hsw_mtx);
+
+		if (oh == NULL)
+			return (NULL);
+
+		Lck_Lock(&oh->mtx);
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			return (oh);
+		}
+		Lck_Unlock(&oh->mtx);
+	}
+}
+
+const struct hash_slinger hsw_slinger = {
+	.magic  =	SLINGER_MAGIC,
+	.name   =	"swiss",
+	.init   =	hsw_init,
+	.start  =	hsw_start,
+	.lookup =	hsw_lookup,
+	.deref  =	hsw_deref,
+};
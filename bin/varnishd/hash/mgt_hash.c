@@ -47,6 +47,7 @@ static const struct choice hsh_choice[] = {
 	{ "simple",		&hsl_slinger },
 	{ "simple_list",	&hsl_slinger },	/* backwards compat */
 	{ "critbit",		&hcb_slinger },
+	{ "swiss",		&hsw_slinger },
 	{ NULL,			NULL }
 };
 
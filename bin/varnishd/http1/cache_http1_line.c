@@ -42,12 +42,19 @@
 #include "config.h"
 
 #include <sys/uio.h>
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_LINUX_SOCKIOS_H)
+#  include <sys/ioctl.h>
+#  include <sys/sendfile.h>
+#  include <linux/sockios.h>
+#  define V1L_SENDFILE
+#endif
 #include "cache/cache_varnishd.h"
 #include "cache/cache_filter.h"
 
 #include <stdio.h>
 
 #include "cache_http1.h"
+#include "vtcp.h"
 #include "vtim.h"
 
 /*--------------------------------------------------------------------*/
@@ -69,6 +76,7 @@ struct v1l {
 	struct ws		*ws;
 	uintptr_t		ws_snap;
 	void			**vdp_priv;
+	unsigned		sendfile;
 };
 
 /*--------------------------------------------------------------------
@@ -134,6 +142,40 @@ V1L_NoRollback(struct v1l *v1l)
 	v1l->ws_snap = 0;
 }
 
+/*--------------------------------------------------------------------
+ * Whatever went out with sendfile() is still referenced by the socket
+ * until the client acknowledged it, also after close(). Once our caller
+ * releases the object, storage may reuse the space, and (re)transmissions
+ * would then send another object's data. Wait for the send queue to
+ * drain. If that does not happen until the deadline, or if sending failed
+ * anyway, reset the connection on close, which drops the queue.
+ */
+
+#ifdef V1L_SENDFILE
+static stream_close_t
+v1l_sendfile_drain(const struct v1l *v1l)
+{
+	vtim_dur d = 1e-3;
+	int n;
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->sendfile);
+
+	while (*v1l->wfd >= 0) {
+		if (ioctl(*v1l->wfd, SIOCOUTQ, &n) == 0 && n == 0)
+			return (SC_NULL);
+		if (VTIM_real() > v1l->deadline) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout draining sendfile");
+			return (SC_TX_ERROR);
+		}
+		VTIM_sleep(d);
+		d = vmin(d * 2, 0.1);
+	}
+	return (SC_NULL);
+}
+#endif
+
 stream_close_t
 V1L_Close(struct v1l **v1lp, uint64_t *cnt)
 {
@@ -149,6 +191,14 @@ V1L_Close(struct v1l **v1lp, uint64_t *cnt)
 		*v1l->vdp_priv = NULL;
 	}
 	sc = V1L_Flush(v1l);
+#ifdef V1L_SENDFILE
+	if (v1l->sendfile && sc == SC_NULL)
+		sc = v1l_sendfile_drain(v1l);
+	if (v1l->sendfile && sc != SC_NULL && *v1l->wfd >= 0) {
+		VSLb(v1l->vsl, SLT_Debug, "Resetting connection after sendfile");
+		(void)VTCP_linger(*v1l->wfd, 1);
+	}
+#endif
 	*cnt = v1l->cnt;
 	ws = v1l->ws;
 	ws_snap = v1l->ws_snap;
@@ -354,6 +404,80 @@ V1L_EndChunk(struct v1l *v1l)
 	(void)V1L_Write(v1l, "0\r\n\r\n", -1);
 }
 
+/*--------------------------------------------------------------------
+ * Send len bytes from offset off of file fd with sendfile(), such that
+ * they do not get copied through user space. Anything queued is flushed
+ * first, so this can not be used with chunked encoding.
+ *
+ * Returns the number of bytes sent. If it is less than len without a
+ * write error having been recorded, the caller should write the rest.
+ */
+
+#ifdef V1L_SENDFILE
+static size_t
+v1l_sendfile(struct v1l *v1l, int fd, off_t off, size_t len)
+{
+	size_t sent = 0;
+	ssize_t i;
+	int err;
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	assert(v1l->ciov == v1l->siov);
+	assert(fd >= 0);
+
+	if (V1L_Flush(v1l) != SC_NULL || *v1l->wfd < 0)
+		return (0);
+
+	do {
+		if (VTIM_real() > v1l->deadline) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "wrote = %zu/%zu; not retrying",
+			    sent, len);
+			i = -1;
+			err = 0;
+			break;
+		}
+
+		i = sendfile(*v1l->wfd, fd, &off, len - sent);
+		err = errno;
+		if (i > 0) {
+			v1l->sendfile = 1;
+			sent += (size_t)i;
+			v1l->cnt += (size_t)i;
+			VSC_C_main->http1_sendfile += (size_t)i;
+			continue;
+		}
+
+		/* nothing sent at all: leave it to writev() */
+		if (i < 0 && sent == 0 && (err == EINVAL || err == ENOSYS))
+			return (0);
+
+		if (i < 0 && err == EWOULDBLOCK) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit idle send timeout, "
+			    "wrote = %zu/%zu; retrying",
+			    sent, len);
+			continue;
+		}
+		break;
+	} while (sent < len);
+
+	if (sent < len) {
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Sendfile error, retval = %zd, len = %zu, errno = %s",
+		    i, len - sent, VAS_errtxt(err));
+		assert(v1l->werr == SC_NULL);
+		if (err == EPIPE)
+			v1l->werr = SC_REM_CLOSE;
+		else
+			v1l->werr = SC_TX_ERROR;
+		errno = err;
+	}
+	return (sent);
+}
+#endif
+
 /*--------------------------------------------------------------------
  * VDP using V1L
  */
@@ -436,12 +560,27 @@ v1l_io_upgrade(VRT_CTX, struct vdp_ctx *vdc, void **priv, int capacity)
  * required to empty the scarab after V1L_Flush()'ing.
  */
 
+/*
+ * If we are the only filter, the leases come straight from storage and, for
+ * unchunked output, we can ask storage for a file to sendfile() them from.
+ * Smaller leases are cheaper to send together with writev().
+ */
+
+#define V1L_SENDFILE_MIN	(16 * 1024)
+
 static int v_matchproto_(vdpio_lease_f)
 v1l_io_lease(struct vdp_ctx *vdc, struct vdp_entry *this, struct vscarab *scarab)
 {
 	struct v1l *v1l;
 	struct viov *v;
+	const char *p;
+	size_t l;
 	int r;
+#ifdef V1L_SENDFILE
+	size_t wl;
+	off_t off;
+	int fd, sf;
+#endif
 
 	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(this, VDP_ENTRY_MAGIC);
@@ -449,11 +588,32 @@ v1l_io_lease(struct vdp_ctx *vdc, struct vdp_entry *this, struct vscarab *scarab
 	VSCARAB_CHECK(scarab);
 	AZ(scarab->used);	// see note above
 	this->calls++;
+#ifdef V1L_SENDFILE
+	sf = cache_param->http1_sendfile &&
+	    VTAILQ_PREV(this, vdp_entry_s, list) == NULL &&
+	    v1l->ciov == v1l->siov;
+#endif
 	r = vdpio_pull(vdc, this, scarab);
 	if (r < 0)
 		return (r);
-	VSCARAB_FOREACH(v, scarab)
-		this->bytes_in += V1L_Write(v1l, v->iov.iov_base, v->iov.iov_len);
+	VSCARAB_FOREACH(v, scarab) {
+		p = v->iov.iov_base;
+		l = v->iov.iov_len;
+#ifdef V1L_SENDFILE
+		fd = -1;
+		if (sf && l >= V1L_SENDFILE_MIN)
+			fd = ObjVAIfd(vdc->wrk, vdc->vai_hdl, v, &off);
+		if (fd >= 0) {
+			wl = v1l_sendfile(v1l, fd, off, l);
+			this->bytes_in += wl;
+			if (v1l->werr != SC_NULL)
+				continue;
+			p += wl;
+			l -= wl;
+		}
+#endif
+		this->bytes_in += V1L_Write(v1l, p, l);
+	}
 	return (r);
 }
 
@@ -116,6 +116,7 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 	assert(p > htc->rxbuf_b);
 	assert(p <= htc->rxbuf_e);
 	hp->nhd = HTTP_HDR_FIRST;
+	HTTP_Reindex(hp, HTTP_HDR_FIRST);
 	r = NULL;		/* For FlexeLint */
 	for (; p < htc->rxbuf_e; p = r) {
 
@@ -124,10 +125,9 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 		if (vct_iscrlf(p, htc->rxbuf_e))
 			break;
 		while (r < htc->rxbuf_e) {
-			if (vct_ishdrval(*r)) {
-				r++;
-				continue;
-			}
+			r += VCT_span_hdrval(r, htc->rxbuf_e);
+			if (r == htc->rxbuf_e)
+				break;
 			i = vct_iscrlf(r, htc->rxbuf_e);
 			if (i == 0) {
 				VSLb(hp->vsl, SLT_BogoHeader,
@@ -198,6 +198,7 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 			hp->hd[hp->nhd].b = p;
 			hp->hd[hp->nhd].e = q;
 			hp->nhd++;
+			HTTP_IndexHdr(hp, hp->nhd - 1);
 		} else {
 			VSLb(hp->vsl, SLT_BogoHeader, "Too many headers: %.*s",
 			    (int)(q - p > 20 ? 20 : q - p), p);
@@ -254,6 +255,7 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 	hp->hd[hf[1]].b = p;
 
 	/* Second field cannot contain LWS or CTL */
+	p += VCT_span_field(p, htc->rxbuf_e);
 	for (; !vct_islws(*p); p++) {
 		if (vct_isctl(*p))
 			return (400);
@@ -276,6 +278,7 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 
 	/* Third field is optional and cannot contain CTL except TAB */
 	q = p;
+	p += VCT_span_hdrval(p, htc->rxbuf_e);
 	for (; p < htc->rxbuf_e && !vct_iscrlf(p, htc->rxbuf_e); p++) {
 		if (vct_isctl(*p) && !vct_issp(*p))
 			return (400);
@@ -257,6 +257,8 @@ h2h_addhdr(struct http *hp, struct h2h_decode *d)
 	}
 
 	hp->hd[n] = hdr;
+	if (n >= HTTP_HDR_FIRST)
+		HTTP_IndexHdr(hp, n);
 	return (0);
 }
 
@@ -183,6 +183,7 @@ STV_Register_The_Usual_Suspects(void)
 	STV_Register(&smf_stevedore, NULL);
 	STV_Register(&sma_stevedore, NULL);
 	STV_Register(&smd_stevedore, NULL);
+	STV_Register(&smt_stevedore, NULL);
 #ifdef WITH_PERSISTENT_STORAGE
 	STV_Register(&smp_stevedore, NULL);
 	STV_Register(&smp_fake_stevedore, NULL);
@@ -261,7 +262,7 @@ STV_Init(void)
 	const char *ident;
 	struct stevedore *stv;
 	const struct stevedore *stv2;
-	int ac;
+	int ac, i, j;
 
 	STV_Register_The_Usual_Suspects();
 	while (!VTAILQ_EMPTY(&pre_stevedores)) {
@@ -291,6 +292,39 @@ STV_Init(void)
 		stv->ident = ident;
 		stv->av = av;
 
+		/* Arguments common to all stevedores */
+		for (i = j = 0; i < ac; i++) {
+			if (!strncmp(av[i], "lru=", 4)) {
+				stv->lru_policy = LRU_Policy(av[i] + 4);
+				if (stv->lru_policy == NULL)
+					ARGV_ERR("(-s %s) unknown lru policy"
+					    " \"%s\"\n", stv->name, av[i] + 4);
+				continue;
+			}
+			if (!strncmp(av[i], "admit=", 6)) {
+				if (strcmp(av[i] + 6, "tinylfu"))
+					ARGV_ERR("(-s %s) unknown admission"
+					    " filter \"%s\"\n", stv->name,
+					    av[i] + 6);
+				stv->lru_admit = 1;
+				continue;
+			}
+			if (!strncmp(av[i], "evict_low=", 10)) {
+				stv->evict_low = av[i] + 10;
+				continue;
+			}
+			if (!strncmp(av[i], "evict_high=", 11)) {
+				stv->evict_high = av[i] + 11;
+				continue;
+			}
+			av[j++] = av[i];
+		}
+		av[j] = NULL;
+		ac = j;
+		if (stv->evict_high != NULL && stv->evict_low == NULL)
+			ARGV_ERR("(-s %s) evict_high requires evict_low\n",
+			    stv->name);
+
 		if (stv->init != NULL)
 			stv->init(stv, ac, av);
 		else if (ac != 0)
@@ -36,6 +36,7 @@
 #include "config.h"
 
 #include "cache/cache_varnishd.h"
+#include "common/heritage.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -192,6 +193,12 @@ STV_open(void)
 		AN(stv->vclname);
 		if (stv->open != NULL)
 			stv->open(stv);
+		if ((stv->lru_policy != NULL || stv->lru_admit) &&
+		    stv->lru == NULL)
+			ARGV_ERR("(-s %s) does not support lru policies\n",
+			    stv->name);
+		if (stv->evict_low != NULL)
+			LRU_Evictor(stv);
 		if (!strcmp(stv->ident, mgt_stv_h2_rxbuf))
 			stv_h2_rxbuf = stv;
 	}
@@ -38,6 +38,7 @@ struct sess;
 struct objcore;
 struct worker;
 struct lru;
+struct lru_policy;
 struct vsl_log;
 struct vfp_ctx;
 struct obj_methods;
@@ -64,11 +65,14 @@ typedef void *storage_allocbuf_f(struct worker *, const struct stevedore *,
     size_t size, uintptr_t *ppriv);
 typedef void storage_freebuf_f(struct worker *, const struct stevedore *,
     uintptr_t priv);
+typedef int storage_demote_f(struct worker *, const struct stevedore *,
+    struct objcore *);
 
 struct storage;
 typedef struct object *sml_getobj_f(struct worker *, struct objcore *);
 typedef struct storage *sml_alloc_f(const struct stevedore *, size_t size);
 typedef void sml_free_f(struct storage *);
+typedef int sml_fd_f(const struct storage *, off_t *);
 
 /* Prototypes for VCL variable responders */
 #define VRTSTVVAR(nm,vt,ct,def) \
@@ -124,12 +128,21 @@ struct stevedore {
 	sml_alloc_f			*sml_alloc;
 	sml_free_f			*sml_free;
 	sml_getobj_f			*sml_getobj;
+	sml_fd_f			*sml_fd;	/* optional */
 
 	const struct obj_methods	*methods;
 
 	/* Only if LRU is used */
+	const struct lru_policy		*lru_policy;
+	unsigned			lru_admit;
+	const char			*evict_low;
+	const char			*evict_high;
 	struct lru			*lru;
 
+	/* Only if part of a tiered stevedore */
+	const struct stevedore		*tier;
+	storage_demote_f		*demote;
+
 #define VRTSTVVAR(nm, vtype, ctype, dval) stv_var_##nm *var_##nm;
 #include "tbl/vrt_stv_var.h"
 
@@ -159,12 +172,17 @@ uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
     const char *ctx);
 
 /*--------------------------------------------------------------------*/
-struct lru *LRU_Alloc(void);
+const struct lru_policy *LRU_Policy(const char *);
+struct lru *LRU_Alloc(const struct stevedore *);
 void LRU_Free(struct lru **);
 void LRU_Add(struct objcore *, vtim_real now);
 void LRU_Remove(struct objcore *);
-int LRU_NukeOne(struct worker *, struct lru *);
+int LRU_NukeOne(struct worker *, struct lru *, size_t want);
+void LRU_Demoted(struct worker *, struct objcore **);
 void LRU_Touch(struct worker *, struct objcore *, vtim_real now);
+void LRU_Count(const struct lru *, const struct objcore *);
+int LRU_Admit(struct worker *, struct lru *, const struct objcore *);
+void LRU_Evictor(struct stevedore *);
 
 /*--------------------------------------------------------------------*/
 extern const struct stevedore smu_stevedore;
@@ -172,3 +190,4 @@ extern const struct stevedore sma_stevedore;
 extern const struct stevedore smd_stevedore;
 extern const struct stevedore smf_stevedore;
 extern const struct stevedore smp_stevedore;
+extern const struct stevedore smt_stevedore;
@@ -64,13 +64,24 @@
 #define MINPAGES		128
 
 /*
- * Number of buckets on free-list.
- *
- * Last bucket is "larger than" so choose number so that the second
- * to last bucket matches the 128k CHUNKSIZE in cache_fetch.c when
- * using a 4K minimal page size
+ * Free ranges are kept on segregated lists indexed by a two-level mapping
+ * of their size in pages: The first level is the power of two, the
+ * second level divides each power of two into SL_COUNT linear classes.
+ * Bitmaps of the non-empty lists allow to find a suitable free range
+ * without searching any list, so allocation and free are O(1), and the
+ * waste of taking a range from the next larger class is bounded by
+ * 1/SL_COUNT of the allocation.
+ */
+#define SL_LOG2			4
+#define SL_COUNT		(1 << SL_LOG2)
+#define FL_COUNT		(64 - SL_LOG2)
+
+/*
+ * Free ranges of fewer pages than this are accounted as small (g_smf_frag),
+ * which matches the 128k CHUNKSIZE in cache_fetch.c when using a 4K
+ * minimal page size
  */
-#define NBUCKET			(128 / 4 + 1)
+#define SMALL_PAGES		(128 / 4 + 1)
 
 static struct VSC_lck *lck_smf;
 
@@ -107,18 +118,87 @@ struct smf_sc {
 	uintmax_t		filesize;
 	int			advice;
 	struct smfhead		order;
-	struct smfhead		free[NBUCKET];
+	uint64_t		fl_bitmap;
+	unsigned		sl_bitmap[FL_COUNT];
+	struct smfhead		free[FL_COUNT][SL_COUNT];
 	struct smfhead		used;
 };
 
 /*--------------------------------------------------------------------*/
 
+static inline unsigned
+smf_fls(uint64_t x)
+{
+	unsigned r = 0;
+
+	AN(x);
+#if __has_builtin(__builtin_clzll)
+	r = 63 - __builtin_clzll(x);
+#else
+	while (x >>= 1)
+		r++;
+#endif
+	return (r);
+}
+
+static inline unsigned
+smf_ffs(uint64_t x)
+{
+	unsigned r = 0;
+
+	AN(x);
+#if __has_builtin(__builtin_ctzll)
+	r = __builtin_ctzll(x);
+#else
+	while (!(x & 1)) {
+		x >>= 1;
+		r++;
+	}
+#endif
+	return (r);
+}
+
+/* Map a number of pages to the free list containing it */
+
+static void
+smf_mapping(uint64_t pages, unsigned *fl, unsigned *sl)
+{
+	unsigned t;
+
+	AN(pages);
+	if (pages < SL_COUNT) {
+		*fl = 0;
+		*sl = (unsigned)pages;
+		return;
+	}
+	t = smf_fls(pages);
+	*sl = (unsigned)(pages >> (t - SL_LOG2)) - SL_COUNT;
+	*fl = t - SL_LOG2 + 1;
+	assert(*fl < FL_COUNT);
+	assert(*sl < SL_COUNT);
+}
+
+/* Smallest number of pages mapped to a free list */
+
+static uint64_t
+smf_class_pages(unsigned fl, unsigned sl)
+{
+
+	assert(fl < FL_COUNT);
+	assert(sl < SL_COUNT);
+	if (fl == 0)
+		return (sl);
+	return ((uint64_t)(SL_COUNT + sl) << (fl - 1));
+}
+
+/*--------------------------------------------------------------------*/
+
 static void v_matchproto_(storage_init_f)
 smf_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *size, *fn, *r;
 	struct smf_sc *sc;
-	unsigned u;
+	unsigned u, v;
 	uintmax_t page_size;
 	int advice = MADV_RANDOM;
 
@@ -156,8 +236,9 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	ALLOC_OBJ(sc, SMF_SC_MAGIC);
 	XXXAN(sc);
 	VTAILQ_INIT(&sc->order);
-	for (u = 0; u < NBUCKET; u++)
-		VTAILQ_INIT(&sc->free[u]);
+	for (u = 0; u < FL_COUNT; u++)
+		for (v = 0; v < SL_COUNT; v++)
+			VTAILQ_INIT(&sc->free[u][v]);
 	VTAILQ_INIT(&sc->used);
 	sc->pagesize = page_size;
 	sc->advice = advice;
@@ -174,79 +255,116 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
  * Insert/Remove from correct freelist
  */
 
+static void
+smf_stats_free(const struct smf_sc *sc)
+{
+	unsigned fl, sl;
+
+	if (sc->fl_bitmap == 0) {
+		sc->stats->g_smf_largest = 0;
+		return;
+	}
+	fl = smf_fls(sc->fl_bitmap);
+	sl = smf_fls(sc->sl_bitmap[fl]);
+	sc->stats->g_smf_largest = smf_class_pages(fl, sl) * sc->pagesize;
+}
+
 static void
 insfree(struct smf_sc *sc, struct smf *sp)
 {
-	off_t b, ns;
-	struct smf *sp2;
+	off_t b;
+	unsigned fl, sl;
 
 	AZ(sp->alloc);
 	assert(sp->flist == NULL);
 	Lck_AssertHeld(&sc->mtx);
 	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
+	if (b >= SMALL_PAGES)
 		sc->stats->g_smf_large++;
-	} else {
-		sc->stats->g_smf_frag++;
-	}
-	sp->flist = &sc->free[b];
-	ns = b * sc->pagesize;
-	VTAILQ_FOREACH(sp2, sp->flist, status) {
-		assert(sp2->size >= ns);
-		AZ(sp2->alloc);
-		assert(sp2->flist == sp->flist);
-		if (sp->offset < sp2->offset)
-			break;
-	}
-	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(sp->flist, sp, status);
 	else
-		VTAILQ_INSERT_BEFORE(sp2, sp, status);
+		sc->stats->g_smf_frag++;
+	smf_mapping(b, &fl, &sl);
+	sp->flist = &sc->free[fl][sl];
+	VTAILQ_INSERT_HEAD(sp->flist, sp, status);
+	sc->sl_bitmap[fl] |= 1U << sl;
+	sc->fl_bitmap |= (uint64_t)1 << fl;
 }
 
 static void
-remfree(const struct smf_sc *sc, struct smf *sp)
+remfree(struct smf_sc *sc, struct smf *sp)
 {
-	size_t b;
+	off_t b;
+	unsigned fl, sl;
 
 	AZ(sp->alloc);
 	assert(sp->flist != NULL);
 	Lck_AssertHeld(&sc->mtx);
 	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
+	if (b >= SMALL_PAGES)
 		sc->stats->g_smf_large--;
-	} else {
+	else
 		sc->stats->g_smf_frag--;
-	}
-	assert(sp->flist == &sc->free[b]);
+	smf_mapping(b, &fl, &sl);
+	assert(sp->flist == &sc->free[fl][sl]);
 	VTAILQ_REMOVE(sp->flist, sp, status);
 	sp->flist = NULL;
+	if (!VTAILQ_EMPTY(&sc->free[fl][sl]))
+		return;
+	sc->sl_bitmap[fl] &= ~(1U << sl);
+	if (sc->sl_bitmap[fl] == 0)
+		sc->fl_bitmap &= ~((uint64_t)1 << fl);
+}
+
+/*--------------------------------------------------------------------
+ * Find the first non-empty free list at or above fl/sl
+ */
+
+static struct smf *
+smf_find(const struct smf_sc *sc, unsigned fl, unsigned sl)
+{
+	uint64_t flmap;
+	unsigned slmap;
+
+	assert(fl < FL_COUNT);
+	assert(sl < SL_COUNT);
+	slmap = sc->sl_bitmap[fl] & (~0U << sl);
+	if (slmap == 0) {
+		if (fl + 1 >= FL_COUNT)
+			return (NULL);
+		flmap = sc->fl_bitmap & (~(uint64_t)0 << (fl + 1));
+		if (flmap == 0)
+			return (NULL);
+		fl = smf_ffs(flmap);
+		slmap = sc->sl_bitmap[fl];
+	}
+	AN(slmap);
+	sl = smf_ffs(slmap);
+	return (VTAILQ_FIRST(&sc->free[fl][sl]));
 }
 
 /*--------------------------------------------------------------------
- * Allocate a range from the first free range that is large enough.
+ * Allocate a range from a free list which only holds ranges large
+ * enough. Only if there is none, search the list of the requested
+ * size, which may hold ranges both smaller and larger.
  */
 
 static struct smf *
 alloc_smf(struct smf_sc *sc, off_t bytes)
 {
 	struct smf *sp, *sp2;
-	off_t b;
+	uint64_t b, r;
+	unsigned fl, sl;
 
 	AZ(bytes % sc->pagesize);
 	b = bytes / sc->pagesize;
-	if (b >= NBUCKET)
-		b = NBUCKET - 1;
-	sp = NULL;
-	for (; b < NBUCKET - 1; b++) {
-		sp = VTAILQ_FIRST(&sc->free[b]);
-		if (sp != NULL)
-			break;
-	}
+	r = b;
+	if (r >= SL_COUNT)
+		r += ((uint64_t)1 << (smf_fls(r) - SL_LOG2)) - 1;
+	smf_mapping(r, &fl, &sl);
+	sp = smf_find(sc, fl, sl);
 	if (sp == NULL) {
-		VTAILQ_FOREACH(sp, &sc->free[NBUCKET -1], status)
+		smf_mapping(b, &fl, &sl);
+		VTAILQ_FOREACH(sp, &sc->free[fl][sl], status)
 			if (sp->size >= bytes)
 				break;
 	}
@@ -281,8 +399,8 @@ alloc_smf(struct smf_sc *sc, off_t bytes)
 }
 
 /*--------------------------------------------------------------------
- * Free a range.  Attempt merge forward and backward, then sort into
- * free list according to age.
+ * Free a range.  Attempt merge forward and backward, then insert into
+ * the free list for its size.
  */
 
 static void
@@ -411,7 +529,7 @@ smf_open(struct stevedore *st)
 	off_t sum = 0;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_smf == NULL)
 		lck_smf = Lck_CreateClass(NULL, "smf");
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
@@ -419,6 +537,7 @@ smf_open(struct stevedore *st)
 	Lck_New(&sc->mtx, lck_smf);
 	Lck_Lock(&sc->mtx);
 	smf_open_chunk(sc, sc->filesize, 0, &fail, &sum);
+	smf_stats_free(sc);
 	Lck_Unlock(&sc->mtx);
 	if (sum < MINPAGES * (off_t)getpagesize()) {
 		ARGV_ERR(
@@ -465,6 +584,7 @@ smf_alloc(const struct stevedore *st, size_t sz)
 	sc->stats->c_bytes += smf->size;
 	sc->stats->g_bytes += smf->size;
 	sc->stats->g_space -= smf->size;
+	smf_stats_free(sc);
 	Lck_Unlock(&sc->mtx);
 	CHECK_OBJ_NOTNULL(&smf->s, STORAGE_MAGIC);	/*lint !e774 */
 	XXXAN(smf);
@@ -493,9 +613,48 @@ smf_free(struct storage *s)
 	sc->stats->g_bytes -= smf->size;
 	sc->stats->g_space += smf->size;
 	free_smf(smf);
+	smf_stats_free(sc);
 	Lck_Unlock(&sc->mtx);
 }
 
+/*--------------------------------------------------------------------
+ * The file offset of a storage, for delivery with sendfile()
+ */
+
+static int v_matchproto_(sml_fd_f)
+smf_fd(const struct storage *s, off_t *off)
+{
+	struct smf *smf;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
+	CHECK_OBJ_NOTNULL(smf->sc, SMF_SC_MAGIC);
+	assert(s->ptr == smf->ptr);
+	AN(off);
+	*off = smf->offset;
+	return (smf->sc->fd);
+}
+
+/*--------------------------------------------------------------------*/
+
+static VCL_BYTES v_matchproto_(stv_var_used_space)
+smf_used_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_bytes);
+}
+
+static VCL_BYTES v_matchproto_(stv_var_free_space)
+smf_free_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_space);
+}
+
 /*--------------------------------------------------------------------*/
 
 const struct stevedore smf_stevedore = {
@@ -505,9 +664,12 @@ const struct stevedore smf_stevedore = {
 	.open		=	smf_open,
 	.sml_alloc	=	smf_alloc,
 	.sml_free	=	smf_free,
+	.sml_fd		=	smf_fd,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
 	.methods	=	&SML_methods,
+	.var_free_space =	smf_free_space,
+	.var_used_space =	smf_used_space,
 	.allocbuf	=	SML_AllocBuf,
 	.freebuf	=	SML_FreeBuf,
 };
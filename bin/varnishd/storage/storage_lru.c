@@ -28,22 +28,109 @@
  * SUCH DAMAGE.
  *
  * Least-Recently-Used logic for freeing space in stevedores.
+ *
+ * Three eviction policies are implemented:
+ *
+ * lru:    The classic: Objects are moved to the tail of the list when
+ *	   touched (at most every lru_interval), the head gets nuked.
+ *
+ * clock:  Second chance: Touching an object only sets its reference bit,
+ *	   without taking the lock. When nuking, referenced objects at the
+ *	   head get their bit cleared and moved to the tail.
+ *
+ * s3fifo: New objects enter a small FIFO queue which holds about ten
+ *	   percent of the objects. Objects touched while in the small queue
+ *	   move to the main queue when they reach its head, all others
+ *	   get nuked and remembered in a ghost table. New objects found in
+ *	   the ghost table go straight to the main queue, which is managed
+ *	   like clock with a two bit frequency counter. One-hit-wonders
+ *	   thus never displace objects from the main queue.
+ *
+ * Optionally, a TinyLFU admission filter estimates how often objects
+ * are requested with a count-min sketch over their digests. While the
+ * storage needs to nuke, new objects only get admitted if they are
+ * estimated to be requested more often than the next victim.
  */
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache/cache_varnishd.h"
 #include "cache/cache_objhead.h"
 
+#include "common/heritage.h"
 #include "storage/storage.h"
 
+#include "vend.h"
+#include "vnum.h"
+#include "vtim.h"
+
+/* oc->lru_queue */
+#define LRU_Q_MAIN		0
+#define LRU_Q_SMALL		1
+
+#define LRU_GHOST_BITS		14
+#define LRU_GHOST_SIZE		(1U << LRU_GHOST_BITS)
+
+/* count-min sketch: rows of 8 bit counters, indexed by digest bytes */
+#define LRU_SKETCH_ROWS		4
+#define LRU_SKETCH_BITS		16
+#define LRU_SKETCH_WIDTH	(1U << LRU_SKETCH_BITS)
+#define LRU_SKETCH_MAX		15
+#define LRU_SKETCH_AGE		(10U * LRU_SKETCH_WIDTH)
+
+struct lru;
+struct lru_evictor;
+
+typedef void lru_add_f(struct lru *, struct objcore *);
+typedef void lru_touch_f(struct worker *, struct lru *, struct objcore *,
+    vtim_real now);
+typedef struct objcore *lru_cand_f(struct worker *, struct lru *);
+typedef const struct objcore *lru_peek_f(const struct lru *);
+
+struct lru_policy {
+	const char		*name;
+	lru_add_f		*add;
+	lru_touch_f		*touch;
+	lru_cand_f		*cand;
+	lru_peek_f		*peek;
+};
+
+struct lru_sketch {
+	unsigned		magic;
+#define LRU_SKETCH_MAGIC	0x2d1e8f3b
+	unsigned		samples;
+	unsigned		aging;
+	uint8_t			row[LRU_SKETCH_ROWS][LRU_SKETCH_WIDTH];
+};
+
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
+	const struct lru_policy	*policy;
 	VTAILQ_HEAD(,objcore)	lru_head;
 	struct lock		mtx;
+
+	/* s3fifo only */
+	VTAILQ_HEAD(,objcore)	small_head;
+	unsigned		n_main;
+	unsigned		n_small;
+	uint32_t		*ghost;
+
+	/* admission only */
+	struct lru_sketch	*sketch;
+
+	/* background evictor only */
+	struct lru_evictor	*evictor;
+	pthread_cond_t		cond;
+
+	/* objects handed to a tier for demotion, not yet freed */
+	unsigned		n_demoting;
+	uintmax_t		demoting;
+	pthread_cond_t		demote_cond;
 };
 
 static struct lru *
@@ -55,15 +142,392 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+static void
+lru_move_tail(struct lru *lru, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&lru->mtx);
+	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	VSC_C_main->n_lru_moved++;
+}
+
+/*--------------------------------------------------------------------
+ * Classic LRU
+ */
+
+static void v_matchproto_(lru_add_f)
+lru_lru_add(struct lru *lru, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&lru->mtx);
+	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	lru->n_main++;
+}
+
+static void v_matchproto_(lru_touch_f)
+lru_lru_touch(struct worker *wrk, struct lru *lru, struct objcore *oc,
+    vtim_real now)
+{
+
+	(void)wrk;
+
+	/*
+	 * To avoid the exphdl->mtx becoming a hotspot, we only
+	 * attempt to move objects if they have not been moved
+	 * recently and if the lock is available.  This optimization
+	 * obviously leaves the LRU list imperfectly sorted.
+	 */
+
+	if (now - OC_TS_UNPACK(oc->last_lru) < cache_param->lru_interval)
+		return;
+
+	if (Lck_Trylock(&lru->mtx))
+		return;
+
+	if (oc->last_lru != OC_TS_NONE) {
+		lru_move_tail(lru, oc);
+		oc->last_lru = OC_TS_PACK(now);
+	}
+	Lck_Unlock(&lru->mtx);
+}
+
+/* Find the first currently unused object on the LRU.  */
+
+static struct objcore * v_matchproto_(lru_cand_f)
+lru_lru_cand(struct worker *wrk, struct lru *lru)
+{
+	struct objcore *oc, *oc2;
+
+	Lck_AssertHeld(&lru->mtx);
+	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		assert(oc->last_lru != OC_TS_NONE);
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (HSH_Snipe(wrk, oc)) {
+			lru_move_tail(lru, oc);
+			return (oc);
+		}
+	}
+	return (NULL);
+}
+
+static const struct objcore * v_matchproto_(lru_peek_f)
+lru_lru_peek(const struct lru *lru)
+{
+
+	Lck_AssertHeld(&lru->mtx);
+	return (VTAILQ_FIRST(&lru->lru_head));
+}
+
+static const struct lru_policy lru_p_lru = {
+	.name =		"lru",
+	.add =		lru_lru_add,
+	.touch =	lru_lru_touch,
+	.cand =		lru_lru_cand,
+	.peek =		lru_lru_peek,
+};
+
+/*--------------------------------------------------------------------
+ * CLOCK / second chance
+ *
+ * lru_freq is updated without holding the lock, we accept the
+ * occasional lost update.
+ */
+
+static void v_matchproto_(lru_touch_f)
+lru_clock_touch(struct worker *wrk, struct lru *lru, struct objcore *oc,
+    vtim_real now)
+{
+
+	(void)wrk;
+	(void)lru;
+	(void)now;
+	/* The delivery of a miss is no reference */
+	if (oc->hits > 0 && oc->lru_freq == 0)
+		oc->lru_freq = 1;
+}
+
+/*
+ * Visit each object at most twice, such that we do not loop forever if
+ * all objects are referenced or in use.
+ */
+
+static struct objcore *
+lru_clock_scan(struct worker *wrk, struct lru *lru, unsigned n)
+{
+	struct objcore *oc;
+
+	Lck_AssertHeld(&lru->mtx);
+	n *= 2;
+	while (n-- > 0) {
+		oc = VTAILQ_FIRST(&lru->lru_head);
+		if (oc == NULL)
+			break;
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		assert(oc->last_lru != OC_TS_NONE);
+		assert(oc->lru_queue == LRU_Q_MAIN);
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (oc->lru_freq == 0 && HSH_Snipe(wrk, oc)) {
+			lru_move_tail(lru, oc);
+			return (oc);
+		}
+		if (oc->lru_freq > 0)
+			oc->lru_freq--;
+		lru_move_tail(lru, oc);
+	}
+	return (NULL);
+}
+
+static struct objcore * v_matchproto_(lru_cand_f)
+lru_clock_cand(struct worker *wrk, struct lru *lru)
+{
+
+	return (lru_clock_scan(wrk, lru, lru->n_main));
+}
+
+static const struct lru_policy lru_p_clock = {
+	.name =		"clock",
+	.add =		lru_lru_add,
+	.touch =	lru_clock_touch,
+	.cand =		lru_clock_cand,
+	.peek =		lru_lru_peek,
+};
+
+/*--------------------------------------------------------------------
+ * S3-FIFO
+ */
+
+static uint32_t *
+lru_ghost_slot(const struct lru *lru, const struct objcore *oc, uint32_t *fp)
+{
+	uint32_t u[2];
+
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	AN(lru->ghost);
+	memcpy(u, oc->objhead->digest, sizeof u);
+	*fp = u[0] | 1;
+	return (&lru->ghost[u[1] & (LRU_GHOST_SIZE - 1)]);
+}
+
+static void v_matchproto_(lru_add_f)
+lru_s3fifo_add(struct lru *lru, struct objcore *oc)
+{
+	uint32_t *slot, fp;
+
+	Lck_AssertHeld(&lru->mtx);
+	slot = lru_ghost_slot(lru, oc, &fp);
+	if (*slot == fp) {
+		*slot = 0;
+		VSC_C_main->n_lru_ghost++;
+		lru_lru_add(lru, oc);
+		return;
+	}
+	oc->lru_queue = LRU_Q_SMALL;
+	VTAILQ_INSERT_TAIL(&lru->small_head, oc, lru_list);
+	lru->n_small++;
+}
+
+static void v_matchproto_(lru_touch_f)
+lru_s3fifo_touch(struct worker *wrk, struct lru *lru, struct objcore *oc,
+    vtim_real now)
+{
+
+	(void)wrk;
+	(void)lru;
+	(void)now;
+	if (oc->hits > 0 && oc->lru_freq < 3)
+		oc->lru_freq++;
+}
+
+static struct objcore *
+lru_s3fifo_small(struct worker *wrk, struct lru *lru)
+{
+	struct objcore *oc;
+	uint32_t *slot, fp;
+
+	Lck_AssertHeld(&lru->mtx);
+	while ((oc = VTAILQ_FIRST(&lru->small_head)) != NULL) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		assert(oc->last_lru != OC_TS_NONE);
+		assert(oc->lru_queue == LRU_Q_SMALL);
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		/*
+		 * Nuked objects stay on the main queue until removed,
+		 * referenced ones and those in use graduate to it.
+		 */
+		VTAILQ_REMOVE(&lru->small_head, oc, lru_list);
+		lru->n_small--;
+		oc->lru_queue = LRU_Q_MAIN;
+		lru_lru_add(lru, oc);
+		VSC_C_main->n_lru_moved++;
+		if (oc->lru_freq == 0 && HSH_Snipe(wrk, oc)) {
+			slot = lru_ghost_slot(lru, oc, &fp);
+			*slot = fp;
+			return (oc);
+		}
+		oc->lru_freq = 0;
+	}
+	return (NULL);
+}
+
+static struct objcore * v_matchproto_(lru_cand_f)
+lru_s3fifo_cand(struct worker *wrk, struct lru *lru)
+{
+	struct objcore *oc = NULL;
+
+	Lck_AssertHeld(&lru->mtx);
+	if (lru->n_small * 10 >= lru->n_small + lru->n_main)
+		oc = lru_s3fifo_small(wrk, lru);
+	if (oc == NULL)
+		oc = lru_clock_scan(wrk, lru, lru->n_main);
+	if (oc == NULL)
+		oc = lru_s3fifo_small(wrk, lru);
+	return (oc);
+}
+
+static const struct objcore * v_matchproto_(lru_peek_f)
+lru_s3fifo_peek(const struct lru *lru)
+{
+
+	Lck_AssertHeld(&lru->mtx);
+	if (lru->n_small * 10 >= lru->n_small + lru->n_main &&
+	    !VTAILQ_EMPTY(&lru->small_head))
+		return (VTAILQ_FIRST(&lru->small_head));
+	return (VTAILQ_FIRST(&lru->lru_head));
+}
+
+static const struct lru_policy lru_p_s3fifo = {
+	.name =		"s3fifo",
+	.add =		lru_s3fifo_add,
+	.touch =	lru_s3fifo_touch,
+	.cand =		lru_s3fifo_cand,
+	.peek =		lru_s3fifo_peek,
+};
+
+/*--------------------------------------------------------------------
+ * TinyLFU count-min sketch
+ *
+ * Counters are updated without holding the lock, we accept the
+ * occasional lost update. Every LRU_SKETCH_AGE updates, all counters
+ * are halved to let the sketch forget about the past. Aging is done by
+ * one of the updating threads and does not hold lru->mtx either, so
+ * it does not stall the LRU.
+ */
+
+static void
+lru_sketch_index(const uint8_t *digest, unsigned idx[LRU_SKETCH_ROWS])
+{
+	unsigned u;
+
+	AN(digest);
+	assert(LRU_SKETCH_ROWS * 2 <= DIGEST_LEN);
+	for (u = 0; u < LRU_SKETCH_ROWS; u++)
+		idx[u] = vbe16dec(digest + 2 * u);
+}
+
+static unsigned
+lru_sketch_estimate(const struct lru_sketch *sk, const uint8_t *digest)
+{
+	unsigned idx[LRU_SKETCH_ROWS], u, r = LRU_SKETCH_MAX;
+
+	CHECK_OBJ_NOTNULL(sk, LRU_SKETCH_MAGIC);
+	lru_sketch_index(digest, idx);
+	for (u = 0; u < LRU_SKETCH_ROWS; u++)
+		r = vmin_t(unsigned, r, sk->row[u][idx[u]]);
+	return (r);
+}
+
+static void
+lru_sketch_age(struct lru_sketch *sk)
+{
+	unsigned u, v;
+
+	for (u = 0; u < LRU_SKETCH_ROWS; u++)
+		for (v = 0; v < LRU_SKETCH_WIDTH; v++)
+			sk->row[u][v] >>= 1;
+	sk->samples = 0;
+}
+
+static void
+lru_sketch_inc(struct lru_sketch *sk, const uint8_t *digest)
+{
+	unsigned idx[LRU_SKETCH_ROWS], u, min;
+
+	CHECK_OBJ_NOTNULL(sk, LRU_SKETCH_MAGIC);
+	lru_sketch_index(digest, idx);
+
+	/* conservative update: only raise the minimal counters */
+	min = lru_sketch_estimate(sk, digest);
+	if (min < LRU_SKETCH_MAX) {
+		for (u = 0; u < LRU_SKETCH_ROWS; u++)
+			if (sk->row[u][idx[u]] == min)
+				sk->row[u][idx[u]]++;
+	}
+
+	if (++sk->samples < LRU_SKETCH_AGE ||
+	    __atomic_exchange_n(&sk->aging, 1, __ATOMIC_ACQUIRE))
+		return;
+	if (sk->samples >= LRU_SKETCH_AGE)
+		lru_sketch_age(sk);
+	__atomic_store_n(&sk->aging, 0, __ATOMIC_RELEASE);
+}
+
+/*--------------------------------------------------------------------*/
+
+static const struct lru_policy * const lru_policies[] = {
+	&lru_p_lru,
+	&lru_p_clock,
+	&lru_p_s3fifo,
+	NULL
+};
+
+const struct lru_policy *
+LRU_Policy(const char *name)
+{
+	const struct lru_policy * const *lp;
+
+	AN(name);
+	for (lp = lru_policies; *lp != NULL; lp++)
+		if (!strcmp((*lp)->name, name))
+			return (*lp);
+	return (NULL);
+}
+
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(const struct stevedore *stv)
 {
+	const struct lru_policy *policy;
 	struct lru *lru;
 
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
+	policy = stv->lru_policy;
+	if (policy == NULL)
+		policy = &lru_p_lru;
+	lru->policy = policy;
 	VTAILQ_INIT(&lru->lru_head);
+	VTAILQ_INIT(&lru->small_head);
+	if (policy == &lru_p_s3fifo) {
+		lru->ghost = calloc(LRU_GHOST_SIZE, sizeof *lru->ghost);
+		AN(lru->ghost);
+	}
+	if (stv->lru_admit) {
+		ALLOC_OBJ(lru->sketch, LRU_SKETCH_MAGIC);
+		AN(lru->sketch);
+	}
 	Lck_New(&lru->mtx, lck_lru);
+	PTOK(pthread_cond_init(&lru->demote_cond, NULL));
 	return (lru);
 }
 
@@ -75,8 +539,14 @@ LRU_Free(struct lru **pp)
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
 	Lck_Lock(&lru->mtx);
 	AN(VTAILQ_EMPTY(&lru->lru_head));
+	AN(VTAILQ_EMPTY(&lru->small_head));
+	AZ(lru->n_demoting);
 	Lck_Unlock(&lru->mtx);
+	PTOK(pthread_cond_destroy(&lru->demote_cond));
 	Lck_Delete(&lru->mtx);
+	free(lru->ghost);
+	if (lru->sketch != NULL)
+		FREE_OBJ(lru->sketch);
 	FREE_OBJ(lru);
 }
 
@@ -91,14 +561,16 @@ LRU_Add(struct objcore *oc, vtim_real now)
 		return;
 
 	AZ(oc->boc);
-	AN(isnan(oc->last_lru));
+	assert(oc->last_lru == OC_TS_NONE);
 	AZ(isnan(now));
 	lru = lru_get(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	oc->lru_queue = LRU_Q_MAIN;
+	oc->lru_freq = 0;
 	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-	oc->last_lru = now;
-	AZ(isnan(oc->last_lru));
+	lru->policy->add(lru, oc);
+	oc->last_lru = OC_TS_PACK(now);
+	assert(oc->last_lru != OC_TS_NONE);
 	Lck_Unlock(&lru->mtx);
 }
 
@@ -116,9 +588,15 @@ LRU_Remove(struct objcore *oc)
 	lru = lru_get(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
 	Lck_Lock(&lru->mtx);
-	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-	oc->last_lru = NAN;
+	assert(oc->last_lru != OC_TS_NONE);
+	if (oc->lru_queue == LRU_Q_SMALL) {
+		VTAILQ_REMOVE(&lru->small_head, oc, lru_list);
+		lru->n_small--;
+	} else {
+		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+		lru->n_main--;
+	}
+	oc->last_lru = OC_TS_NONE;
 	Lck_Unlock(&lru->mtx);
 }
 
@@ -130,69 +608,207 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
-	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
+	if (oc->flags & OC_F_PRIVATE || oc->last_lru == OC_TS_NONE)
 		return;
 
-	/*
-	 * To avoid the exphdl->mtx becoming a hotspot, we only
-	 * attempt to move objects if they have not been moved
-	 * recently and if the lock is available.  This optimization
-	 * obviously leaves the LRU list imperfectly sorted.
-	 */
+	lru = lru_get(oc);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (lru->sketch != NULL && oc->hits > 0)
+		lru_sketch_inc(lru->sketch, oc->objhead->digest);
+	lru->policy->touch(wrk, lru, oc, now);
+}
 
-	if (now - oc->last_lru < cache_param->lru_interval)
+/*--------------------------------------------------------------------
+ * TinyLFU admission
+ *
+ * Every new object counts as a request in the sketch. Only when its
+ * allocation failed and LRU_NukeOne() is about to be called, it is
+ * compared against the next eviction candidate.
+ */
+
+void
+LRU_Count(const struct lru *lru, const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (lru == NULL || lru->sketch == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (oc->flags & OC_F_PRIVATE || oc->objhead == NULL)
 		return;
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	lru_sketch_inc(lru->sketch, oc->objhead->digest);
+}
 
-	lru = lru_get(oc);
+/* Returns: 1: may nuke for oc, 0: reject */
+
+int
+LRU_Admit(struct worker *wrk, struct lru *lru, const struct objcore *oc)
+{
+	const struct objcore *victim;
+	unsigned want, have;
+	int r;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	if (lru == NULL || lru->sketch == NULL)
+		return (1);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (oc->flags & OC_F_PRIVATE || oc->objhead == NULL)
+		return (1);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 
-	if (Lck_Trylock(&lru->mtx))
-		return;
+	r = 1;
+	Lck_Lock(&lru->mtx);
+	victim = lru->policy->peek(lru);
+	if (victim != NULL) {
+		CHECK_OBJ_NOTNULL(victim, OBJCORE_MAGIC);
+		CHECK_OBJ_NOTNULL(victim->objhead, OBJHEAD_MAGIC);
+		want = lru_sketch_estimate(lru->sketch, oc->objhead->digest);
+		have = lru_sketch_estimate(lru->sketch,
+		    victim->objhead->digest);
+		r = want > have;
+	}
+	if (r)
+		VSC_C_main->n_lru_admitted++;
+	else
+		VSC_C_main->n_lru_rejected++;
+	Lck_Unlock(&lru->mtx);
 
-	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-		VSC_C_main->n_lru_moved++;
-		oc->last_lru = now;
+	if (!r)
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Reject p=%p", oc);
+	return (r);
+}
+
+/*--------------------------------------------------------------------
+ * Dispose of an object sniped by the policy
+ *
+ * A tiered stevedore may take over the object to copy it to its cold
+ * tier in the background. Its space is only freed once the tier hands
+ * it back with LRU_Demoted(), until then it is accounted as being
+ * demoted.
+ */
+
+static void
+lru_demoting(struct lru *lru, int n, uintmax_t len)
+{
+
+	Lck_Lock(&lru->mtx);
+	if (n > 0) {
+		lru->n_demoting++;
+		lru->demoting += len;
+	} else {
+		assert(lru->n_demoting > 0);
+		assert(lru->demoting >= len);
+		lru->n_demoting--;
+		lru->demoting -= len;
+		PTOK(pthread_cond_broadcast(&lru->demote_cond));
 	}
 	Lck_Unlock(&lru->mtx);
 }
 
+static void
+lru_nuke(struct worker *wrk, struct lru *lru, struct objcore *oc)
+{
+	const struct stevedore *stv;
+	uintmax_t len;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	/* Give a tiered stevedore the chance to keep a copy */
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	if (stv->tier != NULL && stv->tier->demote != NULL) {
+		len = ObjGetLen(wrk, oc);
+		lru_demoting(lru, 1, len);
+		if (stv->tier->demote(wrk, stv->tier, oc)) {
+			/* The tier took over the ref from HSH_Snipe */
+			VSLb(wrk->vsl, SLT_ExpKill, "LRU_Demote xid=%ju to %s",
+			    VXID(ObjGetXID(wrk, oc)), stv->tier->ident);
+			return;
+		}
+		lru_demoting(lru, -1, len);
+	}
+
+	/* XXX: We could grab and return one storage segment to our caller */
+	ObjSlim(wrk, oc);
+
+	VSLb(wrk->vsl, SLT_ExpKill, "LRU xid=%ju", VXID(ObjGetXID(wrk, oc)));
+	(void)HSH_DerefObjCore(wrk, &oc);	// Ref from HSH_Snipe
+}
+
 /*--------------------------------------------------------------------
- * Attempt to make space by nuking the oldest object on the LRU list
- * which isn't in use.
- * Returns: 1: did, 0: didn't;
+ * Called by the tier once it is done with an object taken over from
+ * lru_nuke(), to free it.
+ */
+
+void
+LRU_Demoted(struct worker *wrk, struct objcore **ocp)
+{
+	struct objcore *oc;
+	struct lru *lru;
+	uintmax_t len;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	TAKE_OBJ_NOTNULL(oc, ocp, OBJCORE_MAGIC);
+	lru = lru_get(oc);
+
+	len = ObjGetLen(wrk, oc);
+	ObjSlim(wrk, oc);
+	VSLb(wrk->vsl, SLT_ExpKill, "LRU xid=%ju", VXID(ObjGetXID(wrk, oc)));
+	(void)HSH_DerefObjCore(wrk, &oc);	// Ref from HSH_Snipe
+	lru_demoting(lru, -1, len);
+}
+
+/*--------------------------------------------------------------------
+ * Attempt to make space for an allocation of at least want bytes by
+ * nuking the oldest object on the LRU list which isn't in use.
+ *
+ * Space still being freed by demotions counts as free: as long as it
+ * covers want, wait for it rather than nuking more, and do not charge
+ * the wait against nuke_limit.
+ *
+ * Returns: 1: did or waited, 0: didn't;
  */
 
 int
-LRU_NukeOne(struct worker *wrk, struct lru *lru)
+LRU_NukeOne(struct worker *wrk, struct lru *lru, size_t want)
 {
-	struct objcore *oc, *oc2;
+	struct objcore *oc;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
 
+	Lck_Lock(&lru->mtx);
+	if (lru->n_demoting > 0 && lru->demoting >= want) {
+		(void)Lck_CondWait(&lru->demote_cond, &lru->mtx);
+		Lck_Unlock(&lru->mtx);
+		return (1);
+	}
+	Lck_Unlock(&lru->mtx);
+
 	if (wrk->strangelove-- <= 0) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU reached nuke_limit");
 		VSC_C_main->n_lru_limited++;
 		return (0);
 	}
 
-	/* Find the first currently unused object on the LRU.  */
 	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
-
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
-
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-			break;
-		}
+	/* The evictor is behind, kick it */
+	if (lru->evictor != NULL)
+		PTOK(pthread_cond_signal(&lru->cond));
+	oc = lru->policy->cand(wrk, lru);
+	if (oc != NULL)
+		VSC_C_main->n_lru_nuked++; // XXX per lru ?
+	else if (lru->n_demoting > 0) {
+		/* Nothing left but demotions, wait for their space */
+		wrk->strangelove++;
+		(void)Lck_CondWait(&lru->demote_cond, &lru->mtx);
+		Lck_Unlock(&lru->mtx);
+		return (1);
 	}
 	Lck_Unlock(&lru->mtx);
 
@@ -201,10 +817,150 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 		return (0);
 	}
 
-	/* XXX: We could grab and return one storage segment to our caller */
-	ObjSlim(wrk, oc);
-
-	VSLb(wrk->vsl, SLT_ExpKill, "LRU xid=%ju", VXID(ObjGetXID(wrk, oc)));
-	(void)HSH_DerefObjCore(wrk, &oc);	// Ref from HSH_Snipe
+	lru_nuke(wrk, lru, oc);
 	return (1);
 }
+
+/*--------------------------------------------------------------------
+ * Background evictor
+ *
+ * Once free space drops below the low watermark, nuke objects in
+ * batches until it is back above the high watermark, such that fetches
+ * rarely need to nuke themselves.
+ */
+
+#define LRU_EVICT_BATCH		16
+#define LRU_EVICT_INTERVAL	0.1
+
+struct lru_evictor {
+	unsigned		magic;
+#define LRU_EVICTOR_MAGIC	0x6c0e55d9
+	const struct stevedore	*stv;
+	uintmax_t		low;
+	uintmax_t		high;
+	pthread_t		thread;
+	struct vsl_log		vsl;
+};
+
+/* nuke up to LRU_EVICT_BATCH objects totalling about want bytes */
+
+static unsigned
+lru_nuke_batch(struct worker *wrk, struct lru *lru, uintmax_t want)
+{
+	struct objcore *oc[LRU_EVICT_BATCH];
+	uintmax_t got = 0;
+	unsigned n, u;
+
+	Lck_Lock(&lru->mtx);
+	for (n = 0; n < LRU_EVICT_BATCH && got < want; n++) {
+		oc[n] = lru->policy->cand(wrk, lru);
+		if (oc[n] == NULL)
+			break;
+		got += ObjGetLen(wrk, oc[n]);
+	}
+	VSC_C_main->n_lru_nuked += n;
+	VSC_C_main->n_lru_evicted += n;
+	Lck_Unlock(&lru->mtx);
+
+	for (u = 0; u < n; u++)
+		lru_nuke(wrk, lru, oc[u]);
+	return (n);
+}
+
+/* space demotions in progress are about to free counts as free */
+
+static uintmax_t
+lru_evict_space(const struct stevedore *stv, struct lru *lru)
+{
+	uintmax_t space;
+
+	space = (uintmax_t)stv->var_free_space(stv);
+	Lck_Lock(&lru->mtx);
+	space += lru->demoting;
+	Lck_Unlock(&lru->mtx);
+	return (space);
+}
+
+static void *
+lru_evictor(struct worker *wrk, void *priv)
+{
+	struct lru_evictor *ev;
+	const struct stevedore *stv;
+	struct lru *lru;
+	uintmax_t space;
+
+	CAST_OBJ_NOTNULL(ev, priv, LRU_EVICTOR_MAGIC);
+	stv = ev->stv;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	lru = stv->lru;
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AN(stv->var_free_space);
+
+	VSL_Setup(&ev->vsl, NULL, 0);
+	AZ(wrk->vsl);
+	wrk->vsl = &ev->vsl;
+
+	while (1) {
+		space = lru_evict_space(stv, lru);
+		if (space < ev->low) {
+			do {
+				if (!lru_nuke_batch(wrk, lru,
+				    ev->high - space))
+					break;
+				space = lru_evict_space(stv, lru);
+			} while (space < ev->high);
+		}
+		VSL_Flush(&ev->vsl, 0);
+		Pool_Sumstat(wrk);
+		Lck_Lock(&lru->mtx);
+		(void)Lck_CondWaitTimeout(&lru->cond, &lru->mtx,
+		    LRU_EVICT_INTERVAL);
+		Lck_Unlock(&lru->mtx);
+	}
+	NEEDLESS(return (NULL));
+}
+
+void
+LRU_Evictor(struct stevedore *stv)
+{
+	struct lru_evictor *ev;
+	struct lru *lru;
+	uintmax_t total;
+	const char *e;
+
+	ASSERT_CLI();
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(stv->evict_low);
+	if (stv->lru == NULL || stv->var_free_space == NULL ||
+	    stv->var_used_space == NULL)
+		ARGV_ERR("(-s %s) does not support eviction watermarks\n",
+		    stv->name);
+	lru = stv->lru;
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AZ(lru->evictor);
+
+	ALLOC_OBJ(ev, LRU_EVICTOR_MAGIC);
+	AN(ev);
+	ev->stv = stv;
+	total = (uintmax_t)stv->var_free_space(stv) +
+	    (uintmax_t)stv->var_used_space(stv);
+
+	e = VNUM_2bytes(stv->evict_low, &ev->low, total);
+	if (e != NULL)
+		ARGV_ERR("(-s %s) evict_low \"%s\": %s\n", stv->name,
+		    stv->evict_low, e);
+	ev->high = ev->low;
+	if (stv->evict_high != NULL) {
+		e = VNUM_2bytes(stv->evict_high, &ev->high, total);
+		if (e != NULL)
+			ARGV_ERR("(-s %s) evict_high \"%s\": %s\n", stv->name,
+			    stv->evict_high, e);
+	}
+	if (ev->high < ev->low || ev->high >= total)
+		ARGV_ERR("(-s %s) eviction watermarks must satisfy "
+		    "evict_low <= evict_high < size\n", stv->name);
+
+	PTOK(pthread_cond_init(&lru->cond, NULL));
+	lru->evictor = ev;
+	WRK_BgThread(&ev->thread, "lru-evictor", lru_evictor, ev);
+}
@@ -46,6 +46,54 @@
 
 #include "VSC_sma.h"
 
+/*--------------------------------------------------------------------
+ * With -s malloc,<size>,<shards> and shards > 1, allocations are served
+ * from per-thread shards, each with its own lock. A shard reserves space
+ * from the global budget in batches of SMA_BATCH_CHUNKS * fetch_chunksize
+ * bytes, so the global sma_mtx is only taken to move space between the
+ * shard and the stevedore and to fold shard statistics into the VSC
+ * counters.
+ *
+ * Freed segments of exactly one of the size classes fetch_chunksize << n
+ * are kept on per-shard slab lists for reuse. Slab segments remain
+ * charged against the storage size and are returned to malloc(3) when
+ * a shard runs out of space.
+ *
+ * Space is freed to the shard which allocated it, so when the storage
+ * is full, the space freed by nuking typically ends up with another
+ * shard. Before an allocation fails, the shard therefore takes back
+ * the budget and slab segments held by all other shards.
+ */
+
+#define SMA_MAX_SHARDS		64
+#define SMA_NCLASS		4
+#define SMA_BATCH_CHUNKS	4
+#define SMA_SLAB_CHUNKS		32
+#define SMA_FLUSH_OPS		64
+
+struct sma;
+VSLIST_HEAD(sma_list, sma);
+
+struct sma_shard {
+	unsigned		magic;
+#define SMA_SHARD_MAGIC		0x5b1c0de3
+	struct lock		mtx;
+	struct sma_sc		*sc;
+	VCL_BYTES		budget;
+	VCL_BYTES		slab_bytes;
+	unsigned		nops;
+	struct sma_list		slab[SMA_NCLASS];
+
+	/* Not yet folded into sc->stats */
+	uint64_t		c_req;
+	uint64_t		c_fail;
+	uint64_t		c_bytes;
+	uint64_t		c_freed;
+	int64_t			g_alloc;
+	int64_t			g_bytes;
+	int64_t			g_slab;
+};
+
 struct sma_sc {
 	unsigned		magic;
 #define SMA_SC_MAGIC		0x1ac8a345
@@ -53,6 +101,8 @@ struct sma_sc {
 	VCL_BYTES		sma_max;
 	VCL_BYTES		sma_alloc;
 	struct VSC_sma		*stats;
+	unsigned		nshard;
+	struct sma_shard	*shards;
 };
 
 struct sma {
@@ -61,10 +111,342 @@ struct sma {
 	struct storage		s;
 	size_t			sz;
 	struct sma_sc		*sc;
+	struct sma_shard	*shard;
+	VSLIST_ENTRY(sma)	list;
 };
 
 static struct VSC_lck *lck_sma;
 
+/*--------------------------------------------------------------------
+ * Sharded allocation
+ */
+
+static struct sma_shard *
+sma_shard(const struct sma_sc *sma_sc)
+{
+	uintptr_t u;
+	uint32_t h;
+
+	/* Worker threads are long-lived, hash them onto a shard */
+	u = (uintptr_t)THR_GetWorker();
+	h = (uint32_t)(u ^ (u >> 20)) * 0x9e3779b1U;
+	return (&sma_sc->shards[(h >> 16) % sma_sc->nshard]);
+}
+
+static int
+sma_class(size_t size)
+{
+	size_t csz;
+	int c;
+
+	csz = cache_param->fetch_chunksize;
+	for (c = 0; c < SMA_NCLASS; c++, csz <<= 1) {
+		if (size > csz)
+			continue;
+		/* Round up by at most 1/8 */
+		if (size < csz - (csz >> 3))
+			return (-1);
+		return (c);
+	}
+	return (-1);
+}
+
+static void
+sma_shard_flush(struct sma_shard *sh)
+{
+	struct sma_sc *sma_sc;
+
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+	sma_sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+	Lck_AssertHeld(&sma_sc->sma_mtx);
+
+	sma_sc->stats->c_req += sh->c_req;
+	sma_sc->stats->c_fail += sh->c_fail;
+	sma_sc->stats->c_bytes += sh->c_bytes;
+	sma_sc->stats->c_freed += sh->c_freed;
+	sma_sc->stats->g_alloc += sh->g_alloc;
+	sma_sc->stats->g_bytes += sh->g_bytes;
+	sma_sc->stats->g_slab += sh->g_slab;
+	if (sma_sc->sma_max != VRT_INTEGER_MAX)
+		sma_sc->stats->g_space = sma_sc->sma_max - sma_sc->sma_alloc;
+	sh->c_req = 0;
+	sh->c_fail = 0;
+	sh->c_bytes = 0;
+	sh->c_freed = 0;
+	sh->g_alloc = 0;
+	sh->g_bytes = 0;
+	sh->g_slab = 0;
+	sh->nops = 0;
+}
+
+/*
+ * Return surplus space to the stevedore and fold statistics every
+ * SMA_FLUSH_OPS operations.
+ */
+
+static void
+sma_shard_tick(struct sma_shard *sh)
+{
+	struct sma_sc *sma_sc;
+	VCL_BYTES batch;
+
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+	sma_sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+
+	batch = (VCL_BYTES)cache_param->fetch_chunksize * SMA_BATCH_CHUNKS;
+	if (++sh->nops < SMA_FLUSH_OPS && sh->budget <= 2 * batch)
+		return;
+	Lck_Lock(&sma_sc->sma_mtx);
+	if (sh->budget > batch) {
+		sma_sc->sma_alloc -= sh->budget - batch;
+		sh->budget = batch;
+	}
+	sma_shard_flush(sh);
+	Lck_Unlock(&sma_sc->sma_mtx);
+}
+
+static int
+sma_shard_reserve(struct sma_shard *sh, size_t size)
+{
+	struct sma_sc *sma_sc;
+	VCL_BYTES want, batch;
+	int retval = 0;
+
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+	sma_sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+
+	if (sh->budget >= (VCL_BYTES)size)
+		return (1);
+
+	batch = (VCL_BYTES)cache_param->fetch_chunksize * SMA_BATCH_CHUNKS;
+	want = (VCL_BYTES)size - sh->budget;
+	Lck_Lock(&sma_sc->sma_mtx);
+	if (sma_sc->sma_alloc + want + batch <= sma_sc->sma_max)
+		want += batch;
+	if (sma_sc->sma_alloc + want <= sma_sc->sma_max) {
+		sma_sc->sma_alloc += want;
+		sh->budget += want;
+		retval = 1;
+	}
+	sma_shard_flush(sh);
+	Lck_Unlock(&sma_sc->sma_mtx);
+	return (retval);
+}
+
+/* Move all slab segments to the drain list, crediting their space */
+
+static void
+sma_shard_drain(struct sma_shard *sh, struct sma_list *drain)
+{
+	struct sma *sma;
+	int c;
+
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+	Lck_AssertHeld(&sh->mtx);
+
+	for (c = 0; c < SMA_NCLASS; c++) {
+		while (!VSLIST_EMPTY(&sh->slab[c])) {
+			sma = VSLIST_FIRST(&sh->slab[c]);
+			CHECK_OBJ(sma, SMA_MAGIC);
+			VSLIST_REMOVE_HEAD(&sh->slab[c], list);
+			sh->slab_bytes -= sma->sz;
+			sh->g_slab -= sma->sz;
+			sh->budget += sma->sz;
+			VSLIST_INSERT_HEAD(drain, sma, list);
+		}
+	}
+	AZ(sh->slab_bytes);
+}
+
+static void
+sma_drain_free(struct sma_list *drain)
+{
+	struct sma *sma;
+
+	while (!VSLIST_EMPTY(drain)) {
+		sma = VSLIST_FIRST(drain);
+		CHECK_OBJ(sma, SMA_MAGIC);
+		VSLIST_REMOVE_HEAD(drain, list);
+		free(sma->s.ptr);
+		FREE_OBJ(sma);
+	}
+}
+
+/* Return the budget and slabs of all shards but ours to the stevedore */
+
+static VCL_BYTES
+sma_shard_reclaim(struct sma_sc *sma_sc, const struct sma_shard *self,
+    struct sma_list *drain)
+{
+	struct sma_shard *sh;
+	VCL_BYTES got = 0;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(sma_sc, SMA_SC_MAGIC);
+	for (u = 0; u < sma_sc->nshard; u++) {
+		sh = &sma_sc->shards[u];
+		CHECK_OBJ(sh, SMA_SHARD_MAGIC);
+		if (sh == self)
+			continue;
+		Lck_Lock(&sh->mtx);
+		if (sh->slab_bytes > 0)
+			sma_shard_drain(sh, drain);
+		if (sh->budget > 0) {
+			Lck_Lock(&sma_sc->sma_mtx);
+			sma_sc->sma_alloc -= sh->budget;
+			got += sh->budget;
+			sh->budget = 0;
+			sma_shard_flush(sh);
+			Lck_Unlock(&sma_sc->sma_mtx);
+		}
+		Lck_Unlock(&sh->mtx);
+	}
+	return (got);
+}
+
+static struct storage * v_matchproto_(sml_alloc_f)
+sma_shard_alloc(const struct stevedore *st, size_t size)
+{
+	struct sma_sc *sma_sc;
+	struct sma_shard *sh;
+	struct sma_list drain;
+	struct sma *sma = NULL;
+	void *p;
+	int c, ok;
+
+	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
+	sh = sma_shard(sma_sc);
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+	c = sma_class(size);
+	if (c >= 0)
+		size = (size_t)cache_param->fetch_chunksize << c;
+	VSLIST_INIT(&drain);
+
+	Lck_Lock(&sh->mtx);
+	sh->c_req++;
+	while (c >= 0 && !VSLIST_EMPTY(&sh->slab[c])) {
+		sma = VSLIST_FIRST(&sh->slab[c]);
+		CHECK_OBJ(sma, SMA_MAGIC);
+		VSLIST_REMOVE_HEAD(&sh->slab[c], list);
+		sh->slab_bytes -= sma->sz;
+		sh->g_slab -= sma->sz;
+		if (sma->sz == size)
+			break;
+		/* fetch_chunksize changed since this was cached */
+		sh->budget += sma->sz;
+		VSLIST_INSERT_HEAD(&drain, sma, list);
+		sma = NULL;
+	}
+	if (sma == NULL) {
+		ok = sma_shard_reserve(sh, size);
+		if (!ok && sh->slab_bytes > 0) {
+			sma_shard_drain(sh, &drain);
+			ok = sma_shard_reserve(sh, size);
+		}
+		if (!ok) {
+			/* Never hold two shard locks */
+			Lck_Unlock(&sh->mtx);
+			if (sma_shard_reclaim(sma_sc, sh, &drain) > 0) {
+				Lck_Lock(&sh->mtx);
+				ok = sma_shard_reserve(sh, size);
+			} else
+				Lck_Lock(&sh->mtx);
+		}
+		if (ok)
+			sh->budget -= size;
+		else {
+			sh->c_fail++;
+			size = 0;
+		}
+	}
+	if (size > 0) {
+		sh->c_bytes += size;
+		sh->g_alloc++;
+		sh->g_bytes += size;
+	}
+	sma_shard_tick(sh);
+	Lck_Unlock(&sh->mtx);
+
+	sma_drain_free(&drain);
+
+	if (sma != NULL) {
+		sma->s.flags = 0;
+		sma->s.len = 0;
+		assert(sma->s.space == size);
+		return (&sma->s);
+	}
+	if (size == 0)
+		return (NULL);
+
+	p = malloc(size);
+	if (p != NULL) {
+		ALLOC_OBJ(sma, SMA_MAGIC);
+		if (sma != NULL)
+			sma->s.ptr = p;
+		else
+			free(p);
+	}
+	if (sma == NULL) {
+		Lck_Lock(&sh->mtx);
+		sh->c_fail++;
+		sh->budget += size;
+		sh->c_bytes -= size;
+		sh->g_alloc--;
+		sh->g_bytes -= size;
+		Lck_Unlock(&sh->mtx);
+		return (NULL);
+	}
+	sma->sc = sma_sc;
+	sma->shard = sh;
+	sma->sz = size;
+	sma->s.priv = sma;
+	sma->s.len = 0;
+	sma->s.space = size;
+	sma->s.magic = STORAGE_MAGIC;
+	return (&sma->s);
+}
+
+static void
+sma_shard_free(struct sma *sma)
+{
+	struct sma_shard *sh;
+	VCL_BYTES slab_max;
+	int c;
+
+	CHECK_OBJ_NOTNULL(sma, SMA_MAGIC);
+	sh = sma->shard;
+	CHECK_OBJ_NOTNULL(sh, SMA_SHARD_MAGIC);
+
+	c = sma_class(sma->sz);
+	if (c >= 0 && sma->sz != (size_t)cache_param->fetch_chunksize << c)
+		c = -1;
+	slab_max = (VCL_BYTES)cache_param->fetch_chunksize * SMA_SLAB_CHUNKS;
+
+	Lck_Lock(&sh->mtx);
+	sh->g_alloc--;
+	sh->g_bytes -= sma->sz;
+	sh->c_freed += sma->sz;
+	if (c >= 0 && sh->slab_bytes + (VCL_BYTES)sma->sz <= slab_max) {
+		VSLIST_INSERT_HEAD(&sh->slab[c], sma, list);
+		sh->slab_bytes += sma->sz;
+		sh->g_slab += sma->sz;
+		sma = NULL;
+	} else
+		sh->budget += sma->sz;
+	sma_shard_tick(sh);
+	Lck_Unlock(&sh->mtx);
+
+	if (sma != NULL) {
+		free(sma->s.ptr);
+		FREE_OBJ(sma);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
 static struct storage * v_matchproto_(sml_alloc_f)
 sma_alloc(const struct stevedore *st, size_t size)
 {
@@ -141,6 +523,10 @@ sma_free(struct storage *s)
 	CAST_OBJ_NOTNULL(sma, s->priv, SMA_MAGIC);
 	sma_sc = sma->sc;
 	assert(sma->sz == sma->s.space);
+	if (sma->shard != NULL) {
+		sma_shard_free(sma);
+		return;
+	}
 	Lck_Lock(&sma_sc->sma_mtx);
 	sma_sc->sma_alloc -= sma->sz;
 	sma_sc->stats->g_alloc--;
@@ -176,18 +562,31 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *e;
 	uintmax_t u;
+	ssize_t n;
 	struct sma_sc *sc;
 
 	ALLOC_OBJ(sc, SMA_SC_MAGIC);
 	AN(sc);
 	sc->sma_max = VRT_INTEGER_MAX;
 	assert(sc->sma_max == VRT_INTEGER_MAX);
+
+	sc->nshard = 1;
 	parent->priv = sc;
 
 	AZ(av[ac]);
-	if (ac > 1)
+	if (ac > 2)
 		ARGV_ERR("(-s%s) too many arguments\n", parent->name);
 
+	if (ac > 1 && *av[1] != '\0') {
+		n = VNUM_uint(av[1], NULL, &e);
+		if (n < 1 || n > SMA_MAX_SHARDS || *e != '\0')
+			ARGV_ERR("(-s%s) shards \"%s\": must be between "
+			    "1 and %u\n", parent->name, av[1], SMA_MAX_SHARDS);
+		sc->nshard = (unsigned)n;
+		if (sc->nshard > 1)
+			parent->sml_alloc = sma_shard_alloc;
+	}
+
 	if (ac == 0 || *av[0] == '\0')
 		 return;
 
@@ -208,9 +607,11 @@ static void v_matchproto_(storage_open_f)
 sma_open(struct stevedore *st)
 {
 	struct sma_sc *sma_sc;
+	struct sma_shard *sh;
+	unsigned u;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_sma == NULL)
 		lck_sma = Lck_CreateClass(NULL, "sma");
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
@@ -218,6 +619,16 @@ sma_open(struct stevedore *st)
 	sma_sc->stats = VSC_sma_New(NULL, NULL, st->ident);
 	if (sma_sc->sma_max != VRT_INTEGER_MAX)
 		sma_sc->stats->g_space = sma_sc->sma_max;
+	if (sma_sc->nshard == 1)
+		return;
+	sma_sc->shards = calloc(sma_sc->nshard, sizeof *sma_sc->shards);
+	AN(sma_sc->shards);
+	for (u = 0; u < sma_sc->nshard; u++) {
+		sh = &sma_sc->shards[u];
+		INIT_OBJ(sh, SMA_SHARD_MAGIC);
+		Lck_New(&sh->mtx, lck_sma);
+		sh->sc = sma_sc;
+	}
 }
 
 const struct stevedore sma_stevedore = {
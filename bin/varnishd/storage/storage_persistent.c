@@ -546,7 +546,7 @@ smp_allocobj(struct worker *wrk, const struct stevedore *stv,
 			stv->sml_free(st);		// NOP
 			st = NULL;
 		}
-	} while (st == NULL && LRU_NukeOne(wrk, stv->lru));
+	} while (st == NULL && LRU_NukeOne(wrk, stv->lru, ltot));
 	if (st == NULL)
 		return (0);
 
@@ -174,7 +174,7 @@ smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
 		oc->stobj->priv2 |= NEED_FIXUP;
 		EXP_COPY(oc, so);
 		sg->nobj++;
-		oc->refcnt++;
+		OC_REF(oc);
 		HSH_Insert(wrk, so->hash, oc, ban);
 		AN(oc->ban);
 		HSH_DerefBoc(wrk, oc);	// XXX Keep it an stream resurrection?
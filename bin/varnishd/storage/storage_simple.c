@@ -145,6 +145,7 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 	struct object *o;
 	struct storage *st = NULL;
 	unsigned ltot;
+	int admitted = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
@@ -154,13 +155,18 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 
 	ltot = sizeof(*o) + PRNDUP(wsl);
 
+	LRU_Count(stv->lru, oc);
 	do {
 		st = stv->sml_alloc(stv, ltot);
 		if (st != NULL && st->space < ltot) {
 			stv->sml_free(st);
 			st = NULL;
 		}
-	} while (st == NULL && LRU_NukeOne(wrk, stv->lru));
+		/* Rejected objects end up on Transient, see vbf_allocobj() */
+		if (st == NULL && !admitted && !LRU_Admit(wrk, stv->lru, oc))
+			return (0);
+		admitted = 1;
+	} while (st == NULL && LRU_NukeOne(wrk, stv->lru, ltot));
 	if (st == NULL)
 		return (0);
 
@@ -615,6 +621,39 @@ sml_ai_return(struct worker *wrk, vai_hdl vhdl, struct vscaret *scaret)
 	}
 }
 
+/*
+ * only leases of whole or partial object storage can be mapped to the
+ * file, fragments with VAI_LEASE_NORET can not be attributed to a st and
+ * the empty viov returning the last st while streaming points elsewhere
+ */
+static int v_matchproto_(vai_fd_f)
+sml_ai_fd(struct worker *wrk, vai_hdl vhdl, const struct viov *viov,
+    off_t *off)
+{
+	struct sml_hdl *hdl;
+	struct storage *st;
+	const unsigned char *p;
+	int fd;
+
+	(void) wrk;
+	CAST_VAI_HDL_NOTNULL(hdl, vhdl, SML_HDL_MAGIC);
+	CHECK_OBJ_NOTNULL(hdl->stv, STEVEDORE_MAGIC);
+	AN(hdl->stv->sml_fd);
+
+	if (viov->lease == VAI_LEASE_NORET || viov->iov.iov_len == 0)
+		return (-1);
+	CAST_OBJ_NOTNULL(st, lease2ptr(viov->lease), STORAGE_MAGIC);
+	if ((st->flags & STORAGE_F_BUFFER) != 0)
+		return (-1);
+	p = viov->iov.iov_base;
+	assert(p >= st->ptr);
+	assert(p + viov->iov.iov_len <= st->ptr + st->space);
+	fd = hdl->stv->sml_fd(st, off);
+	if (fd >= 0)
+		*off += p - st->ptr;
+	return (fd);
+}
+
 static void v_matchproto_(vai_fini_f)
 sml_ai_fini(struct worker *wrk, vai_hdl *vai_hdlp)
 {
@@ -663,7 +702,8 @@ sml_ai_init(struct worker *wrk, struct objcore *oc, struct ws *ws,
 	CHECK_OBJ_NOTNULL(hdl->obj, OBJECT_MAGIC);
 	hdl->stv = oc->stobj->stevedore;
 	CHECK_OBJ_NOTNULL(hdl->stv, STEVEDORE_MAGIC);
-
+	if (hdl->stv->sml_fd != NULL)
+		hdl->preamble.vai_fd = sml_ai_fd;
 
 	hdl->qe.magic = VAI_Q_MAGIC;
 	hdl->qe.cb = notify;
@@ -864,6 +904,7 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, ssize_t size,
     int flags)
 {
 	struct storage *st = NULL;
+	ssize_t want;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
@@ -876,6 +917,11 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, ssize_t size,
 
 	assert(size <= UINT_MAX);	/* field limit in struct storage */
 
+	/* the least sml_stv_alloc() settles for */
+	want = size;
+	if (flags & LESS_MEM_ALLOCED_IS_OK)
+		want = vmin(size, (ssize_t)cache_param->fetch_chunksize);
+
 	do {
 		/* try to allocate from it */
 		st = sml_stv_alloc(stv, size, flags);
@@ -885,7 +931,7 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, ssize_t size,
 		/* no luck; try to free some space and keep trying */
 		if (stv->lru == NULL)
 			break;
-	} while (LRU_NukeOne(wrk, stv->lru));
+	} while (LRU_NukeOne(wrk, stv->lru, (size_t)want));
 
 	CHECK_OBJ_ORNULL(st, STORAGE_MAGIC);
 	return (st);
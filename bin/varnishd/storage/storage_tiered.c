@@ -0,0 +1,567 @@
+/*-
+ * Copyright 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Tiered storage: a hot (typically memory) and a cold (typically file)
+ * stevedore combined.
+ *
+ * New objects go to the hot tier. When the hot tier's LRU nukes an
+ * object, it is queued for a background thread which copies it to the
+ * cold tier before it gets freed. Hits on objects in the cold tier
+ * count towards promotion: once an object reaches the configured number
+ * of hits, another background thread copies it back to the hot tier.
+ * Worker threads thus never wait for a copy between the tiers.
+ *
+ * Objects always live in either of the two tiers, which do all of the
+ * actual storage work, this stevedore only routes allocations and
+ * moves objects between them.
+ */
+
+#include "config.h"
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_obj.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+#include "vrt_obj.h"
+#include "vtim.h"
+
+#include "VSC_smt.h"
+
+#define SMT_QUEUE	64
+
+/*
+ * Objects waiting for a copy, each holding a reference.
+ *
+ * The promotion thread may wait in the hot tier's LRU_NukeOne() for
+ * the demotion thread, which never waits in turn: objects nuked from
+ * the cold tier are not demoted.
+ */
+struct smt_queue {
+	struct objcore		*oc[SMT_QUEUE];
+	unsigned		n;
+	pthread_cond_t		cond;
+	pthread_t		thread;
+};
+
+struct smt_sc {
+	unsigned		magic;
+#define SMT_SC_MAGIC		0x5f0b27a1
+	const char		*hot_ident;
+	const char		*cold_ident;
+	struct stevedore	*hot;
+	struct stevedore	*cold;
+	unsigned		promote_hits;
+
+	struct obj_methods	cold_methods;
+
+	struct lock		mtx;
+	struct VSC_smt		*stats;
+	struct smt_queue	demote;
+	struct smt_queue	promote;
+};
+
+static struct VSC_lck *lck_smt;
+
+/*--------------------------------------------------------------------
+ * Copy an object to another stevedore and insert the copy into the
+ * cache next to the original.
+ *
+ * Returns the new objcore with a reference held, or NULL on failure.
+ */
+
+struct smt_copy {
+	unsigned		magic;
+#define SMT_COPY_MAGIC		0x0e3c9a52
+	struct worker		*wrk;
+	struct objcore		*oc;
+};
+
+static int v_matchproto_(objiterate_f)
+smt_copy_body(void *priv, unsigned flush, const void *ptr, ssize_t len)
+{
+	struct smt_copy *cp;
+	const uint8_t *ps = ptr;
+	uint8_t *pd;
+	ssize_t l;
+
+	CAST_OBJ_NOTNULL(cp, priv, SMT_COPY_MAGIC);
+	(void)flush;
+
+	while (len > 0) {
+		l = len;
+		if (!ObjGetSpace(cp->wrk, cp->oc, &l, &pd))
+			return (-1);
+		AN(pd);
+		l = vmin(l, len);
+		memcpy(pd, ps, l);
+		ObjExtend(cp->wrk, cp->oc, l, 0);
+		ps += l;
+		len -= l;
+	}
+	return (0);
+}
+
+static int
+smt_copy_attr(struct worker *wrk, struct objcore *noc, struct objcore *oc,
+    enum obj_attr attr)
+{
+
+	if (!ObjHasAttr(wrk, oc, attr))
+		return (1);
+	return (!ObjCopyAttr(wrk, noc, oc, attr));
+}
+
+static struct objcore *
+smt_copy(struct worker *wrk, struct objcore *oc, const struct stevedore *dst)
+{
+	struct smt_copy cp[1];
+	struct objcore *noc;
+	struct ban *ban;
+	ssize_t l;
+	unsigned wsl = 0;
+	int ok;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	CHECK_OBJ_NOTNULL(dst, STEVEDORE_MAGIC);
+	AZ(oc->boc);
+
+	/* Without its ban, we cannot tell which bans the copy has seen */
+	ban = BAN_GrabBan(oc);
+	if (ban == NULL)
+		return (NULL);
+
+	if (ObjGetAttr(wrk, oc, OA_VARY, &l) != NULL)
+		wsl += (unsigned)l;
+	if (ObjGetAttr(wrk, oc, OA_HEADERS, &l) != NULL)
+		wsl += (unsigned)l;
+
+	noc = ObjNew(wrk);
+	ok = STV_NewObject(wrk, noc, dst, wsl);
+#define OBJ_FIXATTR(U, l, s)	ok = ok && smt_copy_attr(wrk, noc, oc, OA_##U);
+#define OBJ_VARATTR(U, l)	ok = ok && smt_copy_attr(wrk, noc, oc, OA_##U);
+#define OBJ_AUXATTR(U, l)	ok = ok && smt_copy_attr(wrk, noc, oc, OA_##U);
+#include "tbl/obj_attr.h"
+	if (ok) {
+		INIT_OBJ(cp, SMT_COPY_MAGIC);
+		cp->wrk = wrk;
+		cp->oc = noc;
+		ok = !ObjIterate(wrk, oc, cp, smt_copy_body, 0);
+	}
+
+	if (!ok) {
+		if (noc->stobj->stevedore != NULL)
+			ObjFreeObj(wrk, noc);
+		ObjDestroy(wrk, &noc);
+		BAN_DropBan(&ban);
+		return (NULL);
+	}
+
+	ObjExtend(wrk, noc, 0, 1);
+	EXP_COPY(noc, oc);
+	noc->t_stale_if_error = oc->t_stale_if_error;
+	noc->hits = oc->hits;
+
+	OC_REF(noc);
+	HSH_Insert(wrk, oc->objhead->digest, noc, ban);
+	AN(noc->ban);
+	BAN_DropBan(&ban);
+	HSH_DerefBoc(wrk, noc);
+	return (noc);
+}
+
+/*--------------------------------------------------------------------
+ * Wait for the next object on a queue
+ */
+
+static struct objcore *
+smt_dequeue(struct worker *wrk, struct smt_sc *sc, struct smt_queue *q)
+{
+	struct objcore *oc;
+
+	Lck_Lock(&sc->mtx);
+	while (q->n == 0) {
+		VSL_Flush(wrk->vsl, 0);
+		Pool_Sumstat(wrk);
+		(void)Lck_CondWait(&q->cond, &sc->mtx);
+	}
+	oc = q->oc[--q->n];
+	Lck_Unlock(&sc->mtx);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	return (oc);
+}
+
+/*--------------------------------------------------------------------
+ * Demotion, called from LRU_NukeOne() with the sniped object
+ *
+ * Taking over the sniped object queues it for the demotion thread,
+ * which hands it back to the LRU once it is copied.
+ */
+
+static int v_matchproto_(storage_demote_f)
+smt_demote(struct worker *wrk, const struct stevedore *stv,
+    struct objcore *oc)
+{
+	struct smt_sc *sc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	/* Objects nuked from the cold tier are gone for good */
+	if (oc->stobj->stevedore != sc->hot)
+		return (0);
+	if (oc->flags & (OC_F_HFM|OC_F_HFP|OC_F_PRIVATE|OC_F_FAILED))
+		return (0);
+	if (oc->boc != NULL || EXP_WHEN(oc) <= VTIM_real())
+		return (0);
+
+	Lck_Lock(&sc->mtx);
+	if (sc->demote.n == SMT_QUEUE) {
+		sc->stats->c_demote_drop++;
+		Lck_Unlock(&sc->mtx);
+		return (0);
+	}
+	sc->demote.oc[sc->demote.n++] = oc;
+	PTOK(pthread_cond_signal(&sc->demote.cond));
+	Lck_Unlock(&sc->mtx);
+	return (1);
+}
+
+static void *
+smt_demote_thread(struct worker *wrk, void *priv)
+{
+	struct smt_sc *sc;
+	struct objcore *oc, *noc;
+	struct vsl_log vsl;
+
+	CAST_OBJ_NOTNULL(sc, priv, SMT_SC_MAGIC);
+	VSL_Setup(&vsl, NULL, 0);
+	AZ(wrk->vsl);
+	wrk->vsl = &vsl;
+
+	while (1) {
+		oc = smt_dequeue(wrk, sc, &sc->demote);
+		noc = smt_copy(wrk, oc, sc->cold);
+
+		Lck_Lock(&sc->mtx);
+		if (noc == NULL)
+			sc->stats->c_demote_fail++;
+		else
+			sc->stats->c_demoted++;
+		Lck_Unlock(&sc->mtx);
+
+		if (noc != NULL) {
+			/* Start from scratch on the way up */
+			noc->hits = 0;
+			(void)HSH_DerefObjCore(wrk, &noc);
+		}
+		LRU_Demoted(wrk, &oc);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * Promotion: hits on the cold tier queue objects for the promotion
+ * thread.
+ */
+
+static void v_matchproto_(objtouch_f)
+smt_touch(struct worker *wrk, struct objcore *oc, vtim_real now)
+{
+	const struct stevedore *stv;
+	struct smt_sc *sc;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(stv->tier, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->tier->priv, SMT_SC_MAGIC);
+
+	AN(SML_methods.objtouch);
+	SML_methods.objtouch(wrk, oc, now);
+
+	if (oc->hits < sc->promote_hits || oc->boc != NULL ||
+	    (oc->flags & (OC_F_HFM|OC_F_HFP|OC_F_PRIVATE|OC_F_FAILED|
+	    OC_F_DYING)))
+		return;
+
+	Lck_Lock(&sc->mtx);
+	for (u = 0; u < sc->promote.n; u++)
+		if (sc->promote.oc[u] == oc)
+			break;
+	if (u < sc->promote.n) {
+		Lck_Unlock(&sc->mtx);
+		return;
+	}
+	if (sc->promote.n == SMT_QUEUE) {
+		sc->stats->c_promote_drop++;
+		Lck_Unlock(&sc->mtx);
+		return;
+	}
+	HSH_Ref(oc);
+	sc->promote.oc[sc->promote.n++] = oc;
+	PTOK(pthread_cond_signal(&sc->promote.cond));
+	Lck_Unlock(&sc->mtx);
+}
+
+static void *
+smt_promote_thread(struct worker *wrk, void *priv)
+{
+	struct smt_sc *sc;
+	struct objcore *oc, *noc;
+	struct objhead *oh;
+	struct vsl_log vsl;
+	unsigned dying;
+
+	CAST_OBJ_NOTNULL(sc, priv, SMT_SC_MAGIC);
+	VSL_Setup(&vsl, NULL, 0);
+	AZ(wrk->vsl);
+	wrk->vsl = &vsl;
+
+	while (1) {
+		oc = smt_dequeue(wrk, sc, &sc->promote);
+		oh = oc->objhead;
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+		noc = NULL;
+		if (!(oc->flags & OC_F_DYING))
+			noc = smt_copy(wrk, oc, sc->hot);
+
+		Lck_Lock(&sc->mtx);
+		if (noc == NULL)
+			sc->stats->c_promote_fail++;
+		else
+			sc->stats->c_promoted++;
+		Lck_Unlock(&sc->mtx);
+
+		if (noc != NULL) {
+			/*
+			 * The copy is visible to purges from here on, so
+			 * whichever of the two survives has seen them all.
+			 */
+			Lck_Lock(&oh->mtx);
+			dying = oc->flags & OC_F_DYING;
+			Lck_Unlock(&oh->mtx);
+			if (dying)
+				HSH_Kill(noc);
+			else
+				HSH_Kill(oc);
+			(void)HSH_DerefObjCore(wrk, &noc);
+		}
+		(void)HSH_DerefObjCore(wrk, &oc);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(storage_allocobj_f)
+smt_allocobj(struct worker *wrk, const struct stevedore *stv,
+    struct objcore *oc, unsigned wsl)
+{
+	struct smt_sc *sc;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+
+	if (sc->hot->allocobj(wrk, sc->hot, oc, wsl))
+		return (1);
+	return (sc->cold->allocobj(wrk, sc->cold, oc, wsl));
+}
+
+static void * v_matchproto_(storage_allocbuf_f)
+smt_allocbuf(struct worker *wrk, const struct stevedore *stv, size_t size,
+    uintptr_t *ppriv)
+{
+	struct smt_sc *sc;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+
+	if (sc->hot->allocbuf == NULL)
+		return (NULL);
+	return (sc->hot->allocbuf(wrk, sc->hot, size, ppriv));
+}
+
+static void v_matchproto_(storage_freebuf_f)
+smt_freebuf(struct worker *wrk, const struct stevedore *stv, uintptr_t priv)
+{
+	struct smt_sc *sc;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+
+	AN(sc->hot->freebuf);
+	sc->hot->freebuf(wrk, sc->hot, priv);
+}
+
+static VCL_BYTES v_matchproto_(stv_var_used_space)
+smt_used_space(const struct stevedore *stv)
+{
+	struct smt_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	return (VRT_stevedore_used_space(sc->hot) +
+	    VRT_stevedore_used_space(sc->cold));
+}
+
+static VCL_BYTES v_matchproto_(stv_var_free_space)
+smt_free_space(const struct stevedore *stv)
+{
+	struct smt_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	return (VRT_stevedore_free_space(sc->hot) +
+	    VRT_stevedore_free_space(sc->cold));
+}
+
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(storage_init_f)
+smt_init(struct stevedore *parent, int ac, char * const *av)
+{
+	struct smt_sc *sc;
+	const char *e;
+	ssize_t n;
+
+	ALLOC_OBJ(sc, SMT_SC_MAGIC);
+	AN(sc);
+	sc->promote_hits = 2;
+	parent->priv = sc;
+
+	AZ(av[ac]);
+	if (ac < 2 || ac > 3)
+		ARGV_ERR("(-s%s) need hot and cold storage, and optionally "
+		    "the promotion threshold\n", parent->name);
+	if (*av[0] == '\0' || *av[1] == '\0')
+		ARGV_ERR("(-s%s) storage names must not be empty\n",
+		    parent->name);
+	if (!strcmp(av[0], av[1]))
+		ARGV_ERR("(-s%s) hot and cold storage must differ\n",
+		    parent->name);
+	if (!strcmp(av[0], parent->ident) || !strcmp(av[1], parent->ident))
+		ARGV_ERR("(-s%s) cannot tier onto itself\n", parent->name);
+	sc->hot_ident = strdup(av[0]);
+	AN(sc->hot_ident);
+	sc->cold_ident = strdup(av[1]);
+	AN(sc->cold_ident);
+
+	if (ac > 2 && *av[2] != '\0') {
+		n = VNUM_uint(av[2], NULL, &e);
+		if (n < 1 || n > UINT_MAX || *e != '\0')
+			ARGV_ERR("(-s%s) promotion threshold \"%s\": must be "
+			    "a positive number of hits\n", parent->name,
+			    av[2]);
+		sc->promote_hits = (unsigned)n;
+	}
+}
+
+static struct stevedore *
+smt_find(const struct stevedore *parent, const char *ident)
+{
+	struct stevedore *stv;
+
+	STV_Foreach(stv)
+		if (!strcmp(stv->ident, ident))
+			break;
+	if (stv == NULL)
+		ARGV_ERR("(-s%s) storage \"%s\" not found\n",
+		    parent->name, ident);
+	if (stv == stv_transient)
+		ARGV_ERR("(-s%s) cannot tier Transient storage\n",
+		    parent->name);
+	/* STV_open() sets the vclname before opening */
+	if (stv->vclname == NULL)
+		ARGV_ERR("(-s%s) storage \"%s\" must be defined before "
+		    "the tiered storage\n", parent->name, ident);
+	if (stv->allocobj == smt_allocobj)
+		ARGV_ERR("(-s%s) storage \"%s\" is tiered itself\n",
+		    parent->name, ident);
+	if (stv->tier != NULL)
+		ARGV_ERR("(-s%s) storage \"%s\" is already part of a tier\n",
+		    parent->name, ident);
+	if (stv->lru == NULL || stv->methods != &SML_methods)
+		ARGV_ERR("(-s%s) storage \"%s\" cannot be tiered\n",
+		    parent->name, ident);
+	return (stv);
+}
+
+static void v_matchproto_(storage_open_f)
+smt_open(struct stevedore *st)
+{
+	struct smt_sc *sc;
+
+	ASSERT_CLI();
+	CAST_OBJ_NOTNULL(sc, st->priv, SMT_SC_MAGIC);
+
+	sc->hot = smt_find(st, sc->hot_ident);
+	sc->cold = smt_find(st, sc->cold_ident);
+
+	sc->hot->tier = st;
+	sc->cold->tier = st;
+	sc->cold_methods = SML_methods;
+	sc->cold_methods.objtouch = smt_touch;
+	sc->cold->methods = &sc->cold_methods;
+
+	if (lck_smt == NULL)
+		lck_smt = Lck_CreateClass(NULL, "smt");
+	Lck_New(&sc->mtx, lck_smt);
+	PTOK(pthread_cond_init(&sc->demote.cond, NULL));
+	PTOK(pthread_cond_init(&sc->promote.cond, NULL));
+	sc->stats = VSC_smt_New(NULL, NULL, st->ident);
+	WRK_BgThread(&sc->demote.thread, "smt-demote", smt_demote_thread,
+	    sc);
+	WRK_BgThread(&sc->promote.thread, "smt-promote", smt_promote_thread,
+	    sc);
+}
+
+const struct stevedore smt_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"tiered",
+	.init		=	smt_init,
+	.open		=	smt_open,
+	.allocobj	=	smt_allocobj,
+	.allocbuf	=	smt_allocbuf,
+	.freebuf	=	smt_freebuf,
+	.demote		=	smt_demote,
+	.methods	=	&SML_methods,
+	.var_free_space =	smt_free_space,
+	.var_used_space =	smt_used_space,
+};
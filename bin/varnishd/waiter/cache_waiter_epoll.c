@@ -47,12 +47,36 @@
 #include "waiter/waiter_priv.h"
 #include "vtim.h"
 
+#include "VSC_waiter.h"
+
 #ifndef EPOLLRDHUP
 #  define EPOLLRDHUP 0
 #endif
 
 #define NEEV	8192
 
+/*
+ * Timeouts go on a timing wheel of VWE_NSLOT slots, each VWE_TICK seconds
+ * wide. Slots are expired in bulk, entries due in a later turn of the
+ * wheel are left in place.
+ */
+
+#define VWE_TICK	0.01
+#define VWE_NSLOT	1024
+#define VWE_NOSLOT	UINT_MAX
+
+VTAILQ_HEAD(vwe_wheelhead, waited);
+
+/*
+ * Connections are registered with EPOLLONESHOT, so after an event, the
+ * registration stays with the epoll instance, disarmed, until the fd is
+ * closed. When a connection comes back, it only needs to be re-armed.
+ * Because we never learn about the close, armed[] is a hint, and we fall
+ * back to the other operation if the kernel disagrees.
+ */
+
+#define VWE_ARMED_BITS	(sizeof(uint64_t) * 8)
+
 struct vwe {
 	unsigned		magic;
 #define VWE_MAGIC		0x6bd73424
@@ -64,15 +88,120 @@ struct vwe {
 	unsigned		nwaited;
 	int			die;
 	struct lock		mtx;
+
+	uint64_t		tick;
+	struct vwe_wheelhead	wheel[VWE_NSLOT];
+
+	uint64_t		*armed;
+	unsigned		narmed;
 };
 
 /*--------------------------------------------------------------------*/
 
+static void
+vwe_wheel_insert(struct vwe *vwe, struct waited *wp)
+{
+	uint64_t t;
+
+	Lck_AssertHeld(&vwe->mtx);
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	t = (uint64_t)(Wait_When(wp) / VWE_TICK);
+	if (t < vwe->tick)
+		t = vwe->tick;
+	wp->slot = t % VWE_NSLOT;
+	VTAILQ_INSERT_TAIL(&vwe->wheel[wp->slot], wp, list);
+	vwe->nwaited++;
+	vwe->waiter->vsc->conns++;
+}
+
+static int
+vwe_wheel_delete(struct vwe *vwe, struct waited *wp)
+{
+
+	Lck_AssertHeld(&vwe->mtx);
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	if (wp->slot == VWE_NOSLOT)
+		return (0);
+	assert(wp->slot < VWE_NSLOT);
+	VTAILQ_REMOVE(&vwe->wheel[wp->slot], wp, list);
+	wp->slot = VWE_NOSLOT;
+	AN(vwe->nwaited);
+	vwe->nwaited--;
+	vwe->waiter->vsc->conns--;
+	return (1);
+}
+
+/*
+ * Move everything due by now to the expired list and return when we need
+ * to look again.
+ */
+
+static double
+vwe_wheel_expire(struct vwe *vwe, double now, struct vwe_wheelhead *expired)
+{
+	struct vwe_wheelhead *head;
+	struct waited *wp, *wp2;
+	uint64_t t, tnow;
+	unsigned n;
+
+	Lck_AssertHeld(&vwe->mtx);
+	tnow = (uint64_t)(now / VWE_TICK);
+	if (vwe->tick == 0)
+		vwe->tick = tnow;
+	for (n = 0, t = vwe->tick; t <= tnow && n < VWE_NSLOT; t++, n++) {
+		head = &vwe->wheel[t % VWE_NSLOT];
+		VTAILQ_FOREACH_SAFE(wp, head, list, wp2) {
+			if (Wait_When(wp) > now)
+				continue;
+			AN(vwe_wheel_delete(vwe, wp));
+			VTAILQ_INSERT_TAIL(expired, wp, list);
+		}
+	}
+	vwe->tick = tnow;
+
+	if (vwe->nwaited == 0)
+		return (now + 100);
+	/* Whatever is in slot tnow + n expires by the end of its tick */
+	for (n = 0; n < VWE_NSLOT - 1; n++) {
+		if (!VTAILQ_EMPTY(&vwe->wheel[(tnow + n) % VWE_NSLOT]))
+			break;
+	}
+	return ((tnow + n + 1) * VWE_TICK);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int
+vwe_armed(struct vwe *vwe, int fd, int set)
+{
+	unsigned u, n;
+
+	Lck_AssertHeld(&vwe->mtx);
+	assert(fd >= 0);
+	u = (unsigned)fd / VWE_ARMED_BITS;
+	if (u >= vwe->narmed) {
+		if (!set)
+			return (0);
+		n = vmax(2 * vwe->narmed, u + 1);
+		vwe->armed = realloc(vwe->armed, n * sizeof *vwe->armed);
+		AN(vwe->armed);
+		memset(vwe->armed + vwe->narmed, 0,
+		    (n - vwe->narmed) * sizeof *vwe->armed);
+		vwe->narmed = n;
+	}
+	if (set)
+		vwe->armed[u] |= (uint64_t)1 << (fd % VWE_ARMED_BITS);
+	return ((vwe->armed[u] >> (fd % VWE_ARMED_BITS)) & 1);
+}
+
+/*--------------------------------------------------------------------*/
+
 static void *
 vwe_thread(void *priv)
 {
 	struct epoll_event *ev, *ep;
-	struct waited *wp;
+	struct vwe_wheelhead expired;
+	struct waited *wp, *wp2;
 	struct waiter *w;
 	double now, then;
 	int i, n, active;
@@ -89,32 +218,24 @@ vwe_thread(void *priv)
 
 	now = VTIM_real();
 	while (1) {
-		while (1) {
-			Lck_Lock(&vwe->mtx);
-			/*
-			 * XXX: We could avoid many syscalls here if we were
-			 * XXX: allowed to just close the fd's on timeout.
-			 */
-			then = Wait_HeapDue(w, &wp);
-			if (wp == NULL) {
-				vwe->next = now + 100;
-				break;
-			} else if (then > now) {
-				vwe->next = then;
-				break;
-			}
-			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+		VTAILQ_INIT(&expired);
+		Lck_Lock(&vwe->mtx);
+		vwe->next = vwe_wheel_expire(vwe, now, &expired);
+		then = vwe->next - now;
+		Lck_Unlock(&vwe->mtx);
+
+		/*
+		 * The registration must go before the connection is handed
+		 * back, because a timeout does not necessarily close it.
+		 */
+		VTAILQ_FOREACH_SAFE(wp, &expired, list, wp2) {
 			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
-			AN(vwe->nwaited);
-			vwe->nwaited--;
-			AN(Wait_HeapDelete(w, wp));
-			Lck_Unlock(&vwe->mtx);
 			Wait_Call(w, wp, WAITER_TIMEOUT, now);
 		}
-		then = vwe->next - now;
+
 		i = (int)ceil(1e3 * then);
-		assert(i > 0);
-		Lck_Unlock(&vwe->mtx);
+		if (i <= 0)
+			i = 1;
 		do {
 			/* Due to a linux kernel bug, epoll_wait can
 			   return EINTR when the process is subjected to
@@ -131,18 +252,14 @@ vwe_thread(void *priv)
 			}
 			CAST_OBJ_NOTNULL(wp, ep->data.ptr, WAITED_MAGIC);
 			Lck_Lock(&vwe->mtx);
-			active = Wait_HeapDelete(w, wp);
-			if (active != 0) {
-				AN(vwe->nwaited);
-				vwe->nwaited--;
-			}
+			active = vwe_wheel_delete(vwe, wp);
 			Lck_Unlock(&vwe->mtx);
 			if (active == 0) {
 				VSL(SLT_Debug, NO_VXID,
 				    "epoll: spurious event (%d)", wp->fd);
 				continue;
 			}
-			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
+			/* EPOLLONESHOT disarmed the registration */
 			if (ep->events & EPOLLIN) {
 				if (ep->events & EPOLLRDHUP &&
 				    recv(wp->fd, &c, 1, MSG_PEEK) == 0)
@@ -160,6 +277,7 @@ vwe_thread(void *priv)
 			break;
 	}
 	free(ev);
+	free(vwe->armed);
 	closefd(&vwe->pipe[0]);
 	closefd(&vwe->pipe[1]);
 	closefd(&vwe->epfd);
@@ -173,14 +291,21 @@ vwe_enter(void *priv, struct waited *wp)
 {
 	struct vwe *vwe;
 	struct epoll_event ee;
+	int i, op;
 
 	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	ee.events = EPOLLIN | EPOLLRDHUP;
+	ee.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
 	ee.data.ptr = wp;
 	Lck_Lock(&vwe->mtx);
-	vwe->nwaited++;
-	Wait_HeapInsert(vwe->waiter, wp);
-	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
+	vwe_wheel_insert(vwe, wp);
+	op = vwe_armed(vwe, wp->fd, 0) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	i = epoll_ctl(vwe->epfd, op, wp->fd, &ee);
+	if (i && op == EPOLL_CTL_MOD && errno == ENOENT)
+		i = epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee);
+	else if (i && op == EPOLL_CTL_ADD && errno == EEXIST)
+		i = epoll_ctl(vwe->epfd, EPOLL_CTL_MOD, wp->fd, &ee);
+	AZ(i);
+	(void)vwe_armed(vwe, wp->fd, 1);
 	/* If the epoll isn't due before our timeout, poke it via the pipe */
 	if (Wait_When(wp) < vwe->next)
 		assert(write(vwe->pipe[1], "X", 1) == 1);
@@ -195,11 +320,14 @@ vwe_init(struct waiter *w)
 {
 	struct vwe *vwe;
 	struct epoll_event ee;
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
 	vwe = w->priv;
 	INIT_OBJ(vwe, VWE_MAGIC);
 	vwe->waiter = w;
+	for (u = 0; u < VWE_NSLOT; u++)
+		VTAILQ_INIT(&vwe->wheel[u]);
 
 	vwe->epfd = epoll_create(1);
 	assert(vwe->epfd >= 0);
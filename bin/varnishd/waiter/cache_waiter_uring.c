@@ -0,0 +1,464 @@
+/*-
+ * Copyright 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * io_uring(7) based waiter
+ *
+ * Each waited connection has one single-shot IORING_OP_POLL_ADD in flight,
+ * which the kernel removes when it completes, so unlike with epoll, there
+ * is no syscall to stop watching a connection which became active.
+ * Submissions are batched: Entries queued by the waiter thread, such as
+ * cancellations for timeouts, go in with the io_uring_enter(2) call which
+ * also waits for completions, and entries queued by vwu_enter() flush
+ * whatever else is pending.
+ *
+ * A struct waited belongs to us until the completion of its poll has been
+ * reaped, so user_data never points to memory which has been recycled. A
+ * timeout thus only cancels the poll, and the connection is handed back
+ * when the cancellation completes.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "waiter/waiter.h"
+#include "waiter/waiter_priv.h"
+#include "waiter/mgt_waiter.h"
+#include "vtim.h"
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define NENTRIES	4096
+#define NCQE		(16 * NENTRIES)
+
+struct vwu {
+	unsigned		magic;
+#define VWU_MAGIC		0x0a4c6e21
+	int			ringfd;
+	struct waiter		*waiter;
+	pthread_t		thread;
+	double			next;
+	unsigned		nwaited;
+	int			die;
+	struct lock		mtx;
+
+	void			*ring;
+	size_t			ringsz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqesz;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+/*--------------------------------------------------------------------*/
+
+static int
+vwu_syscall_enter(const struct vwu *vwu, unsigned to_submit,
+    unsigned min_complete, unsigned flags, const void *arg, size_t argsz)
+{
+
+	return ((int)syscall(__NR_io_uring_enter, vwu->ringfd, to_submit,
+	    min_complete, flags, arg, argsz));
+}
+
+static unsigned
+vwu_pending(const struct vwu *vwu)
+{
+
+	return (*vwu->sq_tail - __atomic_load_n(vwu->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Submit what is pending. The kernel can refuse submissions for a while
+ * with EBUSY while completions are backed up, or with EAGAIN. They then
+ * stay queued for the next call or the next round of vwu_thread().
+ */
+
+static int
+vwu_flush(const struct vwu *vwu)
+{
+	int i;
+
+	Lck_AssertHeld(&vwu->mtx);
+	do {
+		i = vwu_syscall_enter(vwu, vwu_pending(vwu), 0, 0, NULL, 0);
+	} while (i < 0 && errno == EINTR);
+	if (i >= 0)
+		return (0);
+	assert(errno == EBUSY || errno == EAGAIN);
+	return (-1);
+}
+
+/* Is there room to queue n more entries? */
+
+static int
+vwu_room(const struct vwu *vwu, unsigned n)
+{
+
+	Lck_AssertHeld(&vwu->mtx);
+	assert(n <= vwu->sq_entries);
+	if (vwu->sq_entries - vwu_pending(vwu) < n)
+		(void)vwu_flush(vwu);
+	return (vwu->sq_entries - vwu_pending(vwu) >= n);
+}
+
+/*
+ * Outside vwu_thread(), wait for room. The kernel accepts submissions
+ * again once the waiter thread has reaped completions.
+ */
+
+static void
+vwu_wait_room(struct vwu *vwu, unsigned n)
+{
+
+	while (!vwu_room(vwu, n)) {
+		Lck_Unlock(&vwu->mtx);
+		VTIM_sleep(1e-3);
+		Lck_Lock(&vwu->mtx);
+	}
+}
+
+/*
+ * Queue a submission. The entries are only consumed by the kernel when
+ * submitted by one of the io_uring_enter(2) calls. The caller makes sure
+ * that there is room.
+ */
+
+static void
+vwu_sqe(struct vwu *vwu, uint8_t opcode, int fd, uint64_t addr,
+    uint32_t events, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+
+	Lck_AssertHeld(&vwu->mtx);
+	assert(vwu_pending(vwu) < vwu->sq_entries);
+
+	tail = *vwu->sq_tail;
+	sqe = &vwu->sqes[tail & vwu->sq_mask];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+	__atomic_store_n(vwu->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Completions of cancellations and wakeups carry no struct waited */
+#define VWU_NOWAITED(vwu, ud) ((ud) == 0 || (ud) == (uintptr_t)(vwu))
+
+/*--------------------------------------------------------------------*/
+
+static enum wait_event
+vwu_event(const struct waited *wp, int res)
+{
+	char c;
+
+	if (res < 0)
+		return (WAITER_REMCLOSE);
+	if (res & POLLIN) {
+		if (res & POLLRDHUP && recv(wp->fd, &c, 1, MSG_PEEK) == 0)
+			return (WAITER_REMCLOSE);
+		return (WAITER_ACTION);
+	}
+	return (WAITER_REMCLOSE);
+}
+
+static void *
+vwu_thread(void *priv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	struct waited *wp, **wps;
+	enum wait_event *evs;
+	struct waiter *w;
+	unsigned head, tail, to_submit;
+	double now, then;
+	int i, n, *res;
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	THR_SetName("cache-uring");
+	THR_Init();
+	wps = calloc(NCQE, sizeof *wps);
+	AN(wps);
+	res = calloc(NCQE, sizeof *res);
+	AN(res);
+	evs = calloc(NCQE, sizeof *evs);
+	AN(evs);
+
+	memset(&arg, 0, sizeof arg);
+	arg.ts = (uintptr_t)&ts;
+
+	now = VTIM_real();
+	while (1) {
+		Lck_Lock(&vwu->mtx);
+		while (1) {
+			then = Wait_HeapDue(w, &wp);
+			if (wp == NULL) {
+				vwu->next = now + 100;
+				break;
+			} else if (then > now) {
+				vwu->next = then;
+				break;
+			} else if (!vwu_room(vwu, 1)) {
+				/* Reap completions first */
+				vwu->next = now;
+				break;
+			}
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AN(Wait_HeapDelete(w, wp));
+			vwu_sqe(vwu, IORING_OP_POLL_REMOVE, -1,
+			    (uintptr_t)wp, 0, 0);
+		}
+		then = vwu->next - now;
+		to_submit = vwu_pending(vwu);
+		Lck_Unlock(&vwu->mtx);
+
+		ts.tv_sec = (long long)floor(then);
+		ts.tv_nsec = (long long)(1e9 * (then - floor(then)));
+		n = vwu_syscall_enter(vwu, to_submit, 1,
+		    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		    &arg, sizeof arg);
+		assert(n >= 0 || errno == EINTR || errno == ETIME ||
+		    errno == EBUSY || errno == EAGAIN);
+		now = VTIM_real();
+
+		/* Reap all completions under one lock */
+		n = 0;
+		Lck_Lock(&vwu->mtx);
+		head = *vwu->cq_head;
+		tail = __atomic_load_n(vwu->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail && n < NCQE; head++) {
+			cqe = &vwu->cqes[head & vwu->cq_mask];
+			if (VWU_NOWAITED(vwu, cqe->user_data))
+				continue;
+			CAST_OBJ_NOTNULL(wp, (void *)(uintptr_t)cqe->user_data,
+			    WAITED_MAGIC);
+			AN(vwu->nwaited);
+			vwu->nwaited--;
+			wps[n] = wp;
+			res[n] = cqe->res;
+			/* No longer on the heap if timed out above */
+			evs[n] = Wait_HeapDelete(w, wp) ?
+			    WAITER_ACTION : WAITER_TIMEOUT;
+			n++;
+		}
+		__atomic_store_n(vwu->cq_head, head, __ATOMIC_RELEASE);
+		Lck_Unlock(&vwu->mtx);
+
+		for (i = 0; i < n; i++) {
+			if (evs[i] == WAITER_ACTION)
+				evs[i] = vwu_event(wps[i], res[i]);
+			Wait_Call(w, wps[i], evs[i], now);
+		}
+		if (vwu->nwaited == 0 && vwu->die)
+			break;
+	}
+	free(wps);
+	free(res);
+	free(evs);
+	AZ(munmap(vwu->sqes, vwu->sqesz));
+	AZ(munmap(vwu->ring, vwu->ringsz));
+	closefd(&vwu->ringfd);
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(waiter_enter_f)
+vwu_enter(void *priv, struct waited *wp)
+{
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	vwu_wait_room(vwu, 2);
+	vwu->nwaited++;
+	Wait_HeapInsert(vwu->waiter, wp);
+	vwu_sqe(vwu, IORING_OP_POLL_ADD, wp->fd, 0, POLLIN | POLLRDHUP,
+	    (uintptr_t)wp);
+	/* If the waiter isn't due before our timeout, wake it up */
+	if (Wait_When(wp) < vwu->next)
+		vwu_sqe(vwu, IORING_OP_NOP, -1, 0, 0, (uintptr_t)vwu);
+	(void)vwu_flush(vwu);
+	Lck_Unlock(&vwu->mtx);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int
+vwu_setup(struct io_uring_params *p)
+{
+	int fd;
+
+	memset(p, 0, sizeof *p);
+	p->flags = IORING_SETUP_CQSIZE;
+	p->cq_entries = NCQE;
+	fd = (int)syscall(__NR_io_uring_setup, NENTRIES, p);
+	if (fd < 0)
+		return (-1);
+	if ((p->features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+	    (p->features & IORING_FEAT_NODROP) == 0 ||
+	    (p->features & IORING_FEAT_EXT_ARG) == 0) {
+		closefd(&fd);
+		errno = ENOTSUP;
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * Seccomp filters, kernel.io_uring_disabled and RLIMIT_MEMLOCK can all
+ * refuse io_uring_setup(2), so the manager tries before starting a child
+ * which could not create its rings.
+ */
+
+int
+VWU_Probe(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	fd = vwu_setup(&p);
+	if (fd < 0)
+		return (-1);
+	closefd(&fd);
+	return (0);
+}
+
+static void v_matchproto_(waiter_init_f)
+vwu_init(struct waiter *w)
+{
+	struct io_uring_params p;
+	struct vwu *vwu;
+	unsigned *array, u;
+	uint8_t *ring;
+	size_t sz;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwu = w->priv;
+	INIT_OBJ(vwu, VWU_MAGIC);
+	vwu->waiter = w;
+
+	vwu->ringfd = vwu_setup(&p);
+	assert(vwu->ringfd >= 0);
+
+	vwu->ringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (sz > vwu->ringsz)
+		vwu->ringsz = sz;
+	vwu->ring = mmap(NULL, vwu->ringsz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->ringfd, IORING_OFF_SQ_RING);
+	assert(vwu->ring != MAP_FAILED);
+	vwu->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+	vwu->sqes = mmap(NULL, vwu->sqesz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->ringfd, IORING_OFF_SQES);
+	assert(vwu->sqes != MAP_FAILED);
+
+	ring = vwu->ring;
+	vwu->sq_head = (void *)(ring + p.sq_off.head);
+	vwu->sq_tail = (void *)(ring + p.sq_off.tail);
+	vwu->sq_mask = *(unsigned *)(void *)(ring + p.sq_off.ring_mask);
+	vwu->sq_entries = p.sq_entries;
+	vwu->cq_head = (void *)(ring + p.cq_off.head);
+	vwu->cq_tail = (void *)(ring + p.cq_off.tail);
+	vwu->cq_mask = *(unsigned *)(void *)(ring + p.cq_off.ring_mask);
+	vwu->cqes = (void *)(ring + p.cq_off.cqes);
+
+	/* We always fill the entries in ring order */
+	array = (void *)(ring + p.sq_off.array);
+	for (u = 0; u < p.sq_entries; u++)
+		array[u] = u;
+
+	Lck_New(&vwu->mtx, lck_waiter);
+	PTOK(pthread_create(&vwu->thread, NULL, vwu_thread, vwu));
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void v_matchproto_(waiter_fini_f)
+vwu_fini(struct waiter *w)
+{
+	struct vwu *vwu;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwu, w->priv, VWU_MAGIC);
+
+	Lck_Lock(&vwu->mtx);
+	vwu->die = 1;
+	vwu_wait_room(vwu, 1);
+	vwu_sqe(vwu, IORING_OP_NOP, -1, 0, 0, (uintptr_t)vwu);
+	(void)vwu_flush(vwu);
+	Lck_Unlock(&vwu->mtx);
+	PTOK(pthread_join(vwu->thread, &vp));
+	Lck_Delete(&vwu->mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct waiter_impl waiter_uring = {
+	.name =		"uring",
+	.init =		vwu_init,
+	.fini =		vwu_fini,
+	.enter =	vwu_enter,
+	.size =		sizeof(struct vwu),
+};
+
+#endif /* defined(HAVE_IO_URING) */
@@ -31,6 +31,9 @@
  */
 
 #include "config.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "mgt/mgt.h"
@@ -55,4 +58,10 @@ Wait_config(const char *arg)
 		waiter = MGT_Pick(waiter_choice, arg, "waiter");
 	else
 		waiter = waiter_choice[0].ptr;
+
+#if defined(HAVE_IO_URING)
+	if (waiter == &waiter_uring && VWU_Probe())
+		ARGV_ERR("-W uring: io_uring is not available (%s)\n",
+		    VAS_errtxt(errno));
+#endif
 }
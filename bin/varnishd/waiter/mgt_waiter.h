@@ -40,3 +40,8 @@ extern struct waiter_impl const * waiter;
 #include "tbl/waiters.h"
 
 void Wait_config(const char *arg);
+
+#if defined(HAVE_IO_URING)
+/* cache_waiter_uring.c */
+int VWU_Probe(void);
+#endif
@@ -61,6 +61,8 @@ struct waited {
 #define WAITED_MAGIC		0x1743992d
 	int			fd;
 	unsigned		idx;
+	unsigned		slot;
+	VTAILQ_ENTRY(waited)	list;
 	void			*priv1;
 	const void		*priv2;
 	waiter_handle_f		*func;
@@ -70,6 +70,19 @@ CLI_CMD(BAN_LIST,
 	0, 0
 )
 
+CLI_CMD(PURGE_TAGS,
+	"purge.tags",
+	"purge.tags <tag> [<tag> ...]",
+	"Purge all objects carrying any of the tags.",
+
+	"  Requires the ``tag_index`` parameter. Objects are tagged by the"
+	" whitespace or comma separated tokens of their ``xkey`` and"
+	" ``Surrogate-Key`` response headers."
+	" Prints the number of objects purged.",
+
+	1, -1
+)
+
 CLI_CMD(VCL_LOAD,
 	"vcl.load",
 	"vcl.load <configname> <filename> [auto|cold|warm]",
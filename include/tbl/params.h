@@ -223,6 +223,21 @@ PARAM_SIMPLE(
 	"A value of zero will disable the ban lurker entirely."
 )
 
+PARAM_SIMPLE(
+	/* name */	ban_lurker_threads,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"threads",
+	/* descr */
+	"Number of threads testing objects for the ban lurker.\n"
+	"With more than one, the ban lurker distributes the objects of each "
+	"ban over this many threads by their hash digest. Each thread has "
+	"its own LURKER counters.",
+	/* flags */	EXPERIMENTAL|MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	ban_lurker_holdoff,
 	/* type */	duration,
@@ -428,8 +443,8 @@ PARAM_SIMPLE(
 	/* def */	"180.000",
 	/* units */	"seconds",
 	/* descr */
-	"How long the critbit hasher keeps deleted objheads on the cooloff "
-	"list.",
+	"How long the critbit and swiss hashers keep deleted objheads on the "
+	"cooloff list.",
 	/* flags */	WIZARD
 )
 
@@ -517,6 +532,29 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	http1_sendfile,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Send body data from file backed storage with sendfile() where "
+	"the HTTP1 delivery supports it, such that it does not get copied "
+	"through user space.\n"
+	"\n"
+	"Data sent with sendfile() remains referenced by the socket until "
+	"the client acknowledged it. Once the object is freed, the storage "
+	"could reuse its space for another object, and retransmissions "
+	"would then send that object's data to this client. Delivery "
+	"therefore holds on to the object until the send queue has "
+	"drained, which keeps the worker thread busy for that time, and "
+	"resets the connection if that does not happen within "
+	"send_timeout.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	fetch_chunksize,
 	/* type */	bytes,
@@ -758,6 +796,22 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	expiry_shards,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"shards",
+	/* descr */
+	"Number of expiry threads.\n"
+	"Objects are distributed over the expiry threads by their hash "
+	"digest, each with its own inbox and timer heap. Increase if the "
+	"inbox backlog of the EXP counters keeps growing under heavy "
+	"object churn.",
+	/* flags */	EXPERIMENTAL|MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	ban_any_variant,
 	/* type */	uint,
@@ -978,6 +1032,21 @@ PARAM_SIMPLE(
 	"Log all CLI traffic to syslog(LOG_INFO)."
 )
 
+PARAM_SIMPLE(
+	/* name */	tag_index,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Index objects by the whitespace or comma separated tags in their "
+	"xkey and Surrogate-Key headers, such that purge.tags() and the "
+	"purge.tags CLI command can purge exactly the objects carrying a "
+	"tag.",
+	/* flags */	EXPERIMENTAL|MUST_RESTART
+)
+
 #if defined(HAVE_TCP_FASTOPEN)
 #  define PLATFORM_FLAGS MUST_RESTART
 #else
@@ -1111,6 +1180,22 @@ PARAM_SIMPLE(
 	"transit buffer per backend request."
 )
 
+PARAM_SIMPLE(
+	/* name */	vary_index,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"variants",
+	/* descr */
+	"Number of objects for the same hash at which an index by their "
+	"Vary header values is built, such that lookups only examine "
+	"matching variants. Zero disables the index.\n"
+	"The index is not used for lookups while ban_any_variant is "
+	"non-zero.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	vary_notice,
 	/* type */	uint,
@@ -1728,6 +1813,93 @@ PARAM_THREAD(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_THREAD(
+	/* name */	thread_pool_steal,
+	/* field */	steal,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"pools",
+	/* descr */
+	"Number of sibling pools to probe for work stealing.\n"
+	"\n"
+	"When a worker thread runs out of work, it takes a queued task "
+	"from the first of this many sibling pools which has one, before "
+	"going idle. Likewise, a task which would be queued for lack of "
+	"an idle thread is handed to an idle thread of a sibling pool if "
+	"there is one. Sibling pools which are busy at that moment are "
+	"skipped, and acceptor tasks are never moved.\n"
+	"\n"
+	"Zero disables work stealing.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_queue_target,
+	/* field */	queue_target,
+	/* type */	duration,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"seconds",
+	/* descr */
+	"Target for the 99th percentile of the time tasks wait in the "
+	"queue of a thread pool.\n"
+	"\n"
+	"When set, the pool herder no longer creates a thread whenever "
+	"a task is queued, but when the queueing delay of any priority "
+	"exceeds this target, and then creates enough threads for the "
+	"current queue at once, up to thread_pool_burst. Idle threads "
+	"are only destroyed while the queueing delay stays below half "
+	"the target.\n"
+	"\n"
+	"Zero selects the classic herder.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_burst,
+	/* field */	burst,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* def */	"10",
+	/* units */	"threads",
+	/* descr */
+	"The maximum number of threads created in one go when the "
+	"queueing delay exceeds thread_pool_queue_target.",
+	/* flags */	EXPERIMENTAL
+)
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP)
+#  define PLATFORM_FLAGS EXPERIMENTAL | MUST_RESTART
+#else
+#  define PLATFORM_FLAGS NOT_IMPLEMENTED
+#endif
+PARAM_THREAD(
+	/* name */	thread_pool_affinity,
+	/* field */	affinity,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Bind each thread pool to a set of CPUs.\n"
+	"\n"
+	"On systems with more than one NUMA node, the pools are assigned "
+	"to the nodes in turn and bound to the CPUs of their node. "
+	"Otherwise, each pool is bound to its share of the CPUs.\n"
+	"\n"
+	"The worker threads, the acceptor and the waiter of a pool are "
+	"all bound with it. Memory is not bound explicitly, but the "
+	"workspaces and the storage a worker allocates are usually "
+	"placed on its node by the kernel's first touch policy.",
+	/* flags */	PLATFORM_DEPENDENT | PLATFORM_FLAGS
+)
+#undef PLATFORM_FLAGS
+
 PARAM_THREAD(
 	/* name */	thread_pool_stack,
 	/* field */	stacksize,
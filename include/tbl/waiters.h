@@ -44,6 +44,10 @@
   WAITER(epoll)
 #endif
 
+#if defined(HAVE_IO_URING)
+  WAITER(uring)
+#endif
+
 WAITER(poll)
 #undef WAITER
 
@@ -57,6 +57,8 @@ extern const uint16_t vct_typtab[256];
 extern const uint8_t vct_lowertab[256];
 
 const char *VCT_invalid_name(const char *b, const char *e);
+size_t VCT_span_hdrval(const char *b, const char *e);
+size_t VCT_span_field(const char *b, const char *e);
 
 static inline int
 vct_is(int x, uint16_t y)
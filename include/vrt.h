@@ -66,6 +66,7 @@
  *	VRT_r_obj_stale_stale_if_error_remaining() added
  *	VRT_r_obj_stale_if_error_remaining() added
  *	VRT_r_beresp_stale_if_error_remaining() added
+ *	VRT_purge_tags() added
  * 22.0 (2025-09-15)
  *	VRT_r_obj_stale_age() added
  *	VRT_r_obj_stale_can_esi() added
@@ -809,6 +810,8 @@ VCL_BYTES VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize);
 
 VCL_STRING VRT_ban_string(VRT_CTX, VCL_STRING);
 VCL_INT VRT_purge(VRT_CTX, VCL_DURATION, VCL_DURATION, VCL_DURATION);
+VCL_INT VRT_purge_tags(VRT_CTX, VCL_STRING, VCL_DURATION, VCL_DURATION,
+    VCL_DURATION);
 VCL_VOID VRT_synth(VRT_CTX, VCL_INT, VCL_STRING);
 VCL_VOID VRT_hit_for_pass(VRT_CTX, VCL_DURATION);
 
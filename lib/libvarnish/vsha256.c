@@ -60,6 +60,14 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__has_include)
+#  if __has_include(<cpuid.h>) && __has_include(<immintrin.h>)
+#    define VSHA256_SHANI 1
+#    include <cpuid.h>
+#    include <immintrin.h>
+#  endif
+#endif
+
 #include "vdef.h"
 
 #include "vas.h"
@@ -221,6 +229,99 @@ VSHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+static void
+vsha256_blocks_c(uint32_t *state, const unsigned char *block, size_t n)
+{
+
+	for (; n > 0; n--, block += 64)
+		VSHA256_Transform(state, block);
+}
+
+#ifdef VSHA256_SHANI
+/*
+ * Same as above using the x86 SHA extensions, four rounds at a time.
+ * The state is kept as ABEF and CDGH, as sha256rnds2 expects it.
+ */
+static void __attribute__((target("sha,sse4.1")))
+vsha256_blocks_shani(uint32_t *state, const unsigned char *block, size_t n)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i st0, st1, abef, cdgh, m, t, w[4];
+	unsigned i;
+
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const void *)&state[0]), 0xb1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const void *)&state[4]), 0x1b);
+	st0 = _mm_alignr_epi8(t, st1, 8);
+	st1 = _mm_blend_epi16(st1, t, 0xf0);
+
+	for (; n > 0; n--, block += 64) {
+		abef = st0;
+		cdgh = st1;
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+				    (const void *)(block + 16 * i)), bswap);
+			} else {
+				t = _mm_alignr_epi8(w[(i + 3) & 3],
+				    w[(i + 2) & 3], 4);
+				w[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(
+				    _mm_sha256msg1_epu32(w[i & 3],
+				    w[(i + 1) & 3]), t), w[(i + 3) & 3]);
+			}
+			m = _mm_add_epi32(w[i & 3],
+			    _mm_loadu_si128((const void *)&K[4 * i]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, m);
+			m = _mm_shuffle_epi32(m, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, m);
+		}
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	t = _mm_shuffle_epi32(st0, 0x1b);
+	st1 = _mm_shuffle_epi32(st1, 0xb1);
+	st0 = _mm_blend_epi16(t, st1, 0xf0);
+	st1 = _mm_alignr_epi8(st1, t, 8);
+	_mm_storeu_si128((void *)&state[0], st0);
+	_mm_storeu_si128((void *)&state[4], st1);
+}
+
+static int
+vsha256_have_shani(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+		return (0);
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return (0);
+	return ((b & bit_SHA) != 0);
+}
+#endif
+
+typedef void vsha256_blocks_f(uint32_t *, const unsigned char *, size_t);
+
+static vsha256_blocks_f vsha256_blocks_select;
+static vsha256_blocks_f *vsha256_blocks = vsha256_blocks_select;
+
+/*
+ * Pick the fastest implementation on first use. Concurrent callers all
+ * arrive at the same choice, so the race is harmless.
+ */
+static void v_matchproto_(vsha256_blocks_f)
+vsha256_blocks_select(uint32_t *state, const unsigned char *block, size_t n)
+{
+	vsha256_blocks_f *f = vsha256_blocks_c;
+
+#ifdef VSHA256_SHANI
+	if (vsha256_have_shani())
+		f = vsha256_blocks_shani;
+#endif
+	vsha256_blocks = f;
+	f(state, block, n);
+}
+
 static const unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -244,7 +345,7 @@ VSHA256_Pad(VSHA256_CTX * ctx)
 	} else {
 		/* Finish the current block and mix. */
 		memcpy(&ctx->buf[r], PAD, 64 - r);
-		VSHA256_Transform(ctx->state, ctx->buf);
+		vsha256_blocks(ctx->state, ctx->buf, 1);
 
 		/* The start of the final block is all zeroes. */
 		memset(&ctx->buf[0], 0, 56);
@@ -254,7 +355,7 @@ VSHA256_Pad(VSHA256_CTX * ctx)
 	vbe64enc(&ctx->buf[56], ctx->count);
 
 	/* Mix in the final block. */
-	VSHA256_Transform(ctx->state, ctx->buf);
+	vsha256_blocks(ctx->state, ctx->buf, 1);
 }
 
 /* SHA-256 initialization.  Begins a SHA-256 operation. */
@@ -301,15 +402,15 @@ VSHA256_Update(VSHA256_CTX * ctx, const void *in, size_t len)
 
 	/* Finish the current block */
 	memcpy(&ctx->buf[r], src, 64 - r);
-	VSHA256_Transform(ctx->state, ctx->buf);
+	vsha256_blocks(ctx->state, ctx->buf, 1);
 	src += 64 - r;
 	len -= 64 - r;
 
 	/* Perform complete blocks */
-	while (len >= 64) {
-		VSHA256_Transform(ctx->state, src);
-		src += 64;
-		len -= 64;
+	if (len >= 64) {
+		vsha256_blocks(ctx->state, src, len >> 6);
+		src += len & ~(size_t)0x3f;
+		len &= 0x3f;
 	}
 
 	/* Copy left over data into buffer */
@@ -373,3 +474,114 @@ VSHA256_Test(void)
 		AZ(memcmp(o, p->output, 32));
 	}
 }
+
+#ifdef TEST_DRIVER
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vtim.h"
+
+static const struct impl {
+	const char		*name;
+	vsha256_blocks_f	*func;
+} impls[] = {
+	{ "c",		vsha256_blocks_c },
+#ifdef VSHA256_SHANI
+	{ "shani",	vsha256_blocks_shani },
+#endif
+	{ NULL,		NULL }
+};
+
+static int
+impl_usable(const struct impl *im)
+{
+#ifdef VSHA256_SHANI
+	if (im->func == vsha256_blocks_shani)
+		return (vsha256_have_shani());
+#endif
+	(void)im;
+	return (1);
+}
+
+/* Hash in pieces, like HSH_AddString() does */
+static void
+hash_pieces(const unsigned char *p, size_t l, unsigned char *o)
+{
+	VSHA256_CTX c;
+	size_t s;
+
+	VSHA256_Init(&c);
+	while (l > 0) {
+		s = random() % (l + 1);
+		VSHA256_Update(&c, p, s);
+		p += s;
+		l -= s;
+	}
+	VSHA256_Final(o, &c);
+}
+
+static void
+cross_check(const struct impl *im)
+{
+	unsigned char buf[1024], ref[32], o[32];
+	size_t l;
+	unsigned u;
+
+	for (u = 0; u < sizeof buf; u++)
+		buf[u] = random() & 0xff;
+	for (l = 0; l <= sizeof buf; l++) {
+		vsha256_blocks = vsha256_blocks_c;
+		hash_pieces(buf, l, ref);
+		vsha256_blocks = im->func;
+		hash_pieces(buf, l, o);
+		AZ(memcmp(ref, o, sizeof o));
+	}
+}
+
+/* Typical cache keys: Host + URL, with some long URLs */
+static void
+bench(const struct impl *im)
+{
+	static const size_t keylen[] = { 24, 64, 128, 512, 0 };
+	unsigned char buf[512], o[32];
+	const size_t *lp;
+	VSHA256_CTX c;
+	vtim_mono t0, t1;
+	unsigned u, n = 200000;
+
+	memset(buf, 'x', sizeof buf);
+	vsha256_blocks = im->func;
+	for (lp = keylen; *lp != 0; lp++) {
+		t0 = VTIM_mono();
+		for (u = 0; u < n; u++) {
+			VSHA256_Init(&c);
+			VSHA256_Update(&c, buf, 16);
+			VSHA256_Update(&c, buf + 16, *lp - 16);
+			VSHA256_Final(o, &c);
+		}
+		t1 = VTIM_mono();
+		printf("%-6s %4zu bytes %8.1f ns/key\n", im->name, *lp,
+		    (t1 - t0) * 1e9 / n);
+	}
+}
+
+int
+main(void)
+{
+	const struct impl *im;
+
+	srandom(VTIM_mono() * 1e6);
+	for (im = impls; im->name != NULL; im++) {
+		if (!impl_usable(im)) {
+			printf("%-6s not supported by this CPU\n", im->name);
+			continue;
+		}
+		vsha256_blocks = im->func;
+		VSHA256_Test();
+		cross_check(im);
+		bench(im);
+	}
+	return (0);
+}
+#endif
@@ -418,10 +418,13 @@ VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
  *
  * If the address is an IPv6 address, the IPV6_V6ONLY option is set to
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
+ *
+ * With reuseport, SO_REUSEPORT is set such that several sockets can be
+ * bound to the same address, which all need to have it set.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -431,6 +434,15 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	if (errp != NULL)
 		*errp = NULL;
 
+#ifndef SO_REUSEPORT
+	if (reuseport) {
+		if (errp != NULL)
+			*errp = "SO_REUSEPORT";
+		errno = ENOPROTOOPT;
+		return (-1);
+	}
+#endif
+
 	proto = VSA_Get_Proto(sa);
 	sd = socket(proto, SOCK_STREAM, 0);
 	if (sd < 0) {
@@ -447,6 +459,18 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+#ifdef SO_REUSEPORT
+	val = 1;
+	if (reuseport &&
+	    setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val) != 0) {
+		if (errp != NULL)
+			*errp = "setsockopt(SO_REUSEPORT, 1)";
+		e = errno;
+		closefd(&sd);
+		errno = e;
+		return (-1);
+	}
+#endif
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -472,6 +496,20 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
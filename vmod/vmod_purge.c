@@ -59,3 +59,18 @@ vmod_soft(VRT_CTX, VCL_DURATION ttl, VCL_DURATION grace, VCL_DURATION keep)
 		keep = NAN;
 	return (VRT_purge(ctx, ttl, grace, keep));
 }
+
+VCL_INT v_matchproto_(td_purge_tags)
+vmod_tags(VRT_CTX, VCL_STRING tags, VCL_BOOL soft, VCL_DURATION ttl,
+    VCL_DURATION grace, VCL_DURATION keep)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (!soft)
+		return (VRT_purge_tags(ctx, tags, 0, 0, 0));
+	if (grace < 0)
+		grace = NAN;
+	if (keep < 0)
+		keep = NAN;
+	return (VRT_purge_tags(ctx, tags, ttl, grace, keep));
+}